@@ -4,24 +4,955 @@
 #include <initializer_list>
 #include <utility>
 #include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <string_view>
+#include <charconv>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <type_traits>
+#include <queue>
+#include <map>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
-class FileActions
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/* CRC32C (Castagnoli, reflected poly 0x82F63B78).
+ * Hardware path: SSE4.2 crc32 on x86, ARMv8 CRC extension on aarch64.
+ * Portable path: slicing-by-8 tables, used when the CPU has neither. */
+static uint32_t crc32cTable[8][256];
+
+static bool initCrc32cTable()
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+        crc32cTable[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crc32cTable[t][i] = (crc32cTable[t - 1][i] >> 8) ^ crc32cTable[0][crc32cTable[t - 1][i] & 0xFF];
+    return true;
+}
+
+static uint32_t crc32cSoftware(uint32_t crc, const unsigned char* p, size_t len)
+{
+    static const bool ready = initCrc32cTable();
+    (void)ready;
+
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        word ^= crc; // little-endian: low 4 bytes pick up the running crc
+        crc = crc32cTable[7][word & 0xFF] ^ crc32cTable[6][(word >> 8) & 0xFF] ^
+              crc32cTable[5][(word >> 16) & 0xFF] ^ crc32cTable[4][(word >> 24) & 0xFF] ^
+              crc32cTable[3][(word >> 32) & 0xFF] ^ crc32cTable[2][(word >> 40) & 0xFF] ^
+              crc32cTable[1][(word >> 48) & 0xFF] ^ crc32cTable[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ crc32cTable[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t len)
+{
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+static bool crc32cHardwareAvailable()
+{
+#if defined(__x86_64__)
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+#elif defined(__ARM_FEATURE_CRC32)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Same calling convention as zlib's crc32(): pass 0 to start, pass the
+ * previous result to continue a running checksum over more data. */
+uint32_t crc32c(uint32_t crc, const void* data, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+    if (crc32cHardwareAvailable())
+        return ~crc32cHardware(crc, p, len);
+#endif
+    return ~crc32cSoftware(crc, p, len);
+}
+
+/* Instrumentation. Every thread owns one cache-line-aligned block of counters
+ * that only it writes (relaxed load+store, no locked instructions), and
+ * collectStats() sums all blocks on demand. Latencies go into log2 buckets:
+ * bucket b counts actions that took [2^b, 2^(b+1)) nanoseconds. */
+enum StatKind
+{
+    KIND_WRITE,
+    KIND_CLOSE,
+    KIND_OTHER,
+    KIND_FLUSH,     // End of an executeActions() batch: staged flush, sync, checksum
+    KIND_COUNT
+};
+
+constexpr int LATENCY_BUCKETS = 40;
+static const char* const statKindNames[KIND_COUNT] = {"write", "close", "other", "flush"};
+
+struct alignas(64) ThreadStats
+{
+    std::atomic<uint64_t> actions[KIND_COUNT] = {};
+    std::atomic<uint64_t> latency[KIND_COUNT][LATENCY_BUCKETS] = {};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<uint64_t> writeCalls{0};
+    std::atomic<uint64_t> writevCalls{0};
+    std::atomic<uint64_t> vmspliceCalls{0};
+    std::atomic<uint64_t> shortWrites{0};
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // A merged run of `count` actions is recorded at its per-action average
+    void recordAction(StatKind kind, uint64_t ns, uint64_t count = 1)
+    {
+        ns /= count;
+        int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+        add(actions[kind], count);
+        add(latency[kind][bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1], count);
+    }
+};
+
+struct StatsSnapshot
+{
+    uint64_t actions[KIND_COUNT] = {};
+    uint64_t latency[KIND_COUNT][LATENCY_BUCKETS] = {};
+    uint64_t bytesWritten = 0;
+    uint64_t writeCalls = 0;
+    uint64_t writevCalls = 0;
+    uint64_t vmspliceCalls = 0;
+    uint64_t shortWrites = 0;
+
+    void accumulate(const ThreadStats& t)
+    {
+        for (int k = 0; k < KIND_COUNT; k++) {
+            actions[k] += t.actions[k].load(std::memory_order_relaxed);
+            for (int b = 0; b < LATENCY_BUCKETS; b++)
+                latency[k][b] += t.latency[k][b].load(std::memory_order_relaxed);
+        }
+        bytesWritten += t.bytesWritten.load(std::memory_order_relaxed);
+        writeCalls += t.writeCalls.load(std::memory_order_relaxed);
+        writevCalls += t.writevCalls.load(std::memory_order_relaxed);
+        vmspliceCalls += t.vmspliceCalls.load(std::memory_order_relaxed);
+        shortWrites += t.shortWrites.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound (ns) of the bucket holding the given percentile
+    uint64_t percentile(StatKind kind, double p) const
+    {
+        uint64_t target = static_cast<uint64_t>(actions[kind] * p);
+        uint64_t seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            seen += latency[kind][b];
+            if (seen > target)
+                return 2ull << b;
+        }
+        return 0;
+    }
+
+    void print(std::ostream& out) const
+    {
+        out << "[Stats] bytes=" << bytesWritten << " write()=" << writeCalls
+            << " writev()=" << writevCalls << " vmsplice()=" << vmspliceCalls << " short-writes=" << shortWrites << "\n";
+        for (int k = 0; k < KIND_COUNT; k++) {
+            if (!actions[k])
+                continue;
+            StatKind kind = static_cast<StatKind>(k);
+            out << "[Stats] " << statKindNames[k] << ": " << actions[k]
+                << (kind == KIND_FLUSH ? " batches" : " actions") << ", p50<" << percentile(kind, 0.50) << "ns p99<" << percentile(kind, 0.99)
+                << "ns p99.9<" << percentile(kind, 0.999) << "ns\n";
+        }
+    }
+};
+
+class StatsRegistry
+{
+private:
+    std::mutex mutex_;
+    std::vector<ThreadStats*> live_;
+    StatsSnapshot retired_;     // Totals of threads that already exited
+
+    struct Slot
+    {
+        ThreadStats stats;
+        Slot() { instance().attach(&stats); }
+        ~Slot() { instance().detach(&stats); }
+    };
+
+    void attach(ThreadStats* t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live_.push_back(t);
+    }
+
+    void detach(ThreadStats* t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        retired_.accumulate(*t);
+        live_.erase(std::find(live_.begin(), live_.end(), t));
+    }
+public:
+    static StatsRegistry& instance()
+    {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    static ThreadStats& local()
+    {
+        thread_local Slot slot;
+        return slot.stats;
+    }
+
+    StatsSnapshot collect()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StatsSnapshot snapshot = retired_;
+        for (const ThreadStats* t : live_)
+            snapshot.accumulate(*t);
+        return snapshot;
+    }
+};
+
+inline StatsSnapshot collectStats() { return StatsRegistry::instance().collect(); }
+
+/* Command names are interned once into small opcodes so bulk loaders do not
+ * have to carry (or allocate) a token string per action. The table may be
+ * used from several threads; names never move once interned, so name()
+ * can hand out references. */
+enum ActionOp : uint8_t
+{
+    OP_WRITE = 0,
+    OP_CLOSE = 1,
+    OP_FIRST_CUSTOM = 2,
+    OP_INVALID = 0xFF   // intern() result once every other opcode is taken
+};
+
+class CommandTable
+{
+private:
+    static std::mutex& mutex()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::deque<std::string>& names()
+    {
+        static std::deque<std::string> table = {"write", "close"};
+        return table;
+    }
+public:
+    // OP_INVALID if cmd is new and the table is full
+    static uint8_t intern(std::string_view cmd)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        std::deque<std::string>& table = names();
+        for (size_t i = 0; i < table.size(); i++)
+            if (table[i] == cmd)
+                return static_cast<uint8_t>(i);
+
+        if (table.size() >= OP_INVALID)
+            return OP_INVALID;
+        table.emplace_back(cmd);
+        return static_cast<uint8_t>(table.size() - 1);
+    }
+
+    static const std::string& name(uint8_t op)
+    {
+        static const std::string invalid = "(invalid)";
+        std::lock_guard<std::mutex> lock(mutex());
+        std::deque<std::string>& table = names();
+        return op < table.size() ? table[op] : invalid;
+    }
+};
+
+/* How executeActions() emits runs of consecutive "write" actions.
+ * OUTPUT_WRITE:    one write() per action (the original behaviour).
+ * OUTPUT_WRITEV:   records are formatted into page-aligned staging chunks
+ *                  and flushed with writev().
+ * OUTPUT_VMSPLICE: same staging, but for pipes the chunks are gifted to the
+ *                  kernel with vmsplice(SPLICE_F_GIFT), skipping the copy
+ *                  into the pipe buffer. Falls back to writev() if refused. */
+enum OutputMode
+{
+    OUTPUT_WRITE,
+    OUTPUT_WRITEV,
+    OUTPUT_VMSPLICE
+};
+
+/* Process-wide pool of 64 KiB staging chunks carved out of 2 MiB slabs.
+ * A slab is backed by an explicit hugepage (MAP_HUGETLB) when the system has
+ * some reserved, otherwise by a 2 MiB aligned mapping marked MADV_HUGEPAGE
+ * so transparent hugepages can back it, otherwise by plain 4 KiB pages.
+ * Chunks go back on the free list after every flush, so repeated
+ * executeActions() calls on any handle reuse already-faulted memory. */
+class StagingPool
+{
+public:
+    static constexpr size_t CHUNK = 64 * 1024;
+    static constexpr size_t SLAB = 2u << 20;
+
+    enum Backing
+    {
+        BACKING_HUGETLB,
+        BACKING_THP,
+        BACKING_PAGES
+    };
+private:
+    std::mutex mutex_;
+    std::vector<char*> slabs_;
+    std::vector<void*> free_;
+    bool pooling_ = true;
+    bool hugePages_ = true;
+    Backing backing_ = BACKING_PAGES;
+
+    char* mapSlab()
+    {
+        if (hugePages_) {
+            void* p = mmap(nullptr, SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                backing_ = BACKING_HUGETLB;
+                return static_cast<char*>(p);
+            }
+        }
+
+        // Over-map so the slab can be aligned to a hugepage boundary
+        void* raw = mmap(nullptr, 2 * SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return nullptr;
+        char* base = static_cast<char*>(raw);
+        char* slab = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(base) + SLAB - 1) & ~(SLAB - 1));
+        if (slab > base)
+            munmap(base, slab - base);
+        if (slab + SLAB < base + 2 * SLAB)
+            munmap(slab + SLAB, base + 2 * SLAB - (slab + SLAB));
+
+        backing_ = BACKING_PAGES;
+        if (hugePages_ && madvise(slab, SLAB, MADV_HUGEPAGE) == 0)
+            backing_ = BACKING_THP;
+        return slab;
+    }
+
+    bool owns(void* chunk) const
+    {
+        for (char* slab : slabs_)
+            if (chunk >= slab && chunk < slab + SLAB)
+                return true;
+        return false;
+    }
+public:
+    static StagingPool& instance()
+    {
+        static StagingPool pool;
+        return pool;
+    }
+
+    ~StagingPool()
+    {
+        for (char* slab : slabs_)
+            munmap(slab, SLAB);
+    }
+
+    // Both knobs only affect slabs mapped afterwards; meant for benchmarks
+    void setPooling(bool pooling) { pooling_ = pooling; }
+    void setHugePages(bool hugePages) { hugePages_ = hugePages; }
+    Backing backing() const { return backing_; }
+
+    void* acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pooling_) {
+            void* p = mmap(nullptr, CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+        if (free_.empty()) {
+            char* slab = mapSlab();
+            if (!slab)
+                return nullptr;
+            slabs_.push_back(slab);
+            for (size_t off = SLAB; off > 0; off -= CHUNK)
+                free_.push_back(slab + off - CHUNK);
+        }
+        void* chunk = free_.back();
+        free_.pop_back();
+        return chunk;
+    }
+
+    void release(void* chunk)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owns(chunk))
+            free_.push_back(chunk);
+        else
+            munmap(chunk, CHUNK);
+    }
+};
+
+/* Outcome of one writeAll() batch */
+struct WriteProgress
+{
+    size_t requested = 0;
+    size_t written = 0;
+    unsigned syscalls = 0;
+    unsigned shortWrites = 0;   // Transfers that stopped part way and were resumed
+    unsigned interrupts = 0;    // EINTR retries
+    unsigned waits = 0;         // poll() waits after EAGAIN
+    int error = 0;              // errno that stopped the batch, 0 when complete
+
+    bool complete() const { return error == 0 && written == requested; }
+};
+
+/* Resumable write engine. Pushes every byte of iov[0..count) to fd, with
+ * write() for a single buffer, writev() for several, or vmsplice() when
+ * gift is set. A short transfer advances iov in place and continues from
+ * the exact byte it stopped at, EINTR is retried, and EAGAIN on
+ * non-blocking descriptors waits in poll(POLLOUT). On a hard error iov
+ * still describes exactly what is left, so calling again resumes the batch. */
+static WriteProgress writeAll(int fd, iovec* iov, int count, bool gift, ThreadStats& stats)
+{
+    WriteProgress progress;
+    int first = 0;
+    for (int i = 0; i < count; i++)
+        progress.requested += iov[i].iov_len;
+
+    size_t remaining = progress.requested;
+    while (remaining > 0) {
+        while (iov[first].iov_len == 0)
+            first++;
+
+        ssize_t n;
+        if (gift) {
+            n = vmsplice(fd, iov + first, count - first, SPLICE_F_GIFT);
+            ThreadStats::add(stats.vmspliceCalls);
+        } else if (count - first == 1) {
+            n = write(fd, iov[first].iov_base, iov[first].iov_len);
+            ThreadStats::add(stats.writeCalls);
+        } else {
+            n = writev(fd, iov + first, count - first);
+            ThreadStats::add(stats.writevCalls);
+        }
+        progress.syscalls++;
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                progress.interrupts++;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd = {fd, POLLOUT, 0};
+                progress.waits++;
+                if (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+                    continue;
+            }
+            progress.error = errno;
+            break;
+        }
+
+        if (static_cast<size_t>(n) < remaining) {
+            progress.shortWrites++;
+            ThreadStats::add(stats.shortWrites);
+        }
+        remaining -= n;
+        progress.written += n;
+        ThreadStats::add(stats.bytesWritten, n);
+
+        for (size_t left = n; left > 0; ) {
+            size_t step = std::min(left, iov[first].iov_len);
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + step;
+            iov[first].iov_len -= step;
+            left -= step;
+            if (iov[first].iov_len == 0 && first + 1 < count)
+                first++;
+        }
+    }
+    return progress;
+}
+
+/* Compile-time I/O policies for BasicFileActions. Each choice is a small
+ * struct whose members inline away, so executeActions() carries no runtime
+ * branch for them.
+ *
+ * Buffering: whether write actions go straight to write() or through the
+ * staging chunks. RuntimeBuffering keeps the choice in setOutputMode(). */
+struct UnbufferedWrites
+{
+    static constexpr bool staged(OutputMode) { return false; }
+};
+
+struct StagedWrites
+{
+    static constexpr bool staged(OutputMode) { return true; }
+};
+
+struct RuntimeBuffering
+{
+    static bool staged(OutputMode mode) { return mode != OUTPUT_WRITE; }
+};
+
+/* Sync: hooks run after every successful write, after every executeActions()
+ * batch, and before the descriptor is closed. */
+struct NoSync
+{
+    void afterWrite(int, size_t) {}
+    void afterBatch(int) {}
+    void beforeClose(int) {}
+};
+
+struct SyncPerBatch
+{
+    void afterWrite(int, size_t) {}
+    void afterBatch(int fd) { fdatasync(fd); }
+    void beforeClose(int) {}
+};
+
+struct SyncOnClose
+{
+    void afterWrite(int, size_t) {}
+    void afterBatch(int) {}
+    void beforeClose(int fd) { fsync(fd); }
+};
+
+/* Streaming writeback for multi-GB outputs: every WindowBytes of output
+ * starts asynchronous writeback of the newest window with sync_file_range(),
+ * waits for the window before it and drops that one from the page cache
+ * with POSIX_FADV_DONTNEED. The file's dirty/cached footprint therefore stays
+ * around two windows instead of growing until the kernel stalls everyone. */
+template <size_t WindowBytes = (8u << 20)>
+struct StreamingSync
+{
+    off_t cursor_ = -1;     // End of our output, -1 until the first write
+    off_t kicked_ = 0;      // Writeback started for [synced_, kicked_)
+    off_t synced_ = 0;      // Everything below is on disk and evicted
+    size_t highWater_ = 0;  // Largest cursor_ - synced_ seen
+    bool disabled_ = false; // Not seekable (pipe, socket): nothing to do
+
+    void afterWrite(int fd, size_t n)
+    {
+        if (disabled_)
+            return;
+        if (cursor_ < 0) {
+            off_t end = lseek(fd, 0, SEEK_CUR);
+            if (end == -1) {
+                disabled_ = true;
+                return;
+            }
+            cursor_ = kicked_ = synced_ = end - static_cast<off_t>(n);
+        }
+        cursor_ += n;
+        highWater_ = std::max(highWater_, static_cast<size_t>(cursor_ - synced_));
+
+        if (cursor_ - kicked_ < static_cast<off_t>(WindowBytes))
+            return;
+        sync_file_range(fd, kicked_, cursor_ - kicked_, SYNC_FILE_RANGE_WRITE);
+        if (kicked_ > synced_)
+            release(fd, kicked_);
+        kicked_ = cursor_;
+    }
+
+    void afterBatch(int) {}
+
+    // Leave nothing of ours behind in the page cache
+    void beforeClose(int fd)
+    {
+        if (!disabled_ && cursor_ > synced_)
+            release(fd, cursor_);
+    }
+
+    void release(int fd, off_t end)
+    {
+        sync_file_range(fd, synced_, end - synced_,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, synced_, end - synced_, POSIX_FADV_DONTNEED);
+        synced_ = end;
+    }
+
+    size_t dirtyHighWater() const { return highWater_; }
+};
+
+/* Format: how one write operand is rendered. format() writes at most
+ * MAX_RECORD bytes and returns the end of the record. */
+struct TextRecords
+{
+    static constexpr size_t MAX_RECORD = 32;
+
+    static char* format(char* p, int32_t val)
+    {
+        std::memcpy(p, "Value: ", 7);
+        p = std::to_chars(p + 7, p + MAX_RECORD, val).ptr;
+        *p++ = '\n';
+        return p;
+    }
+
+    static size_t size(int32_t val)
+    {
+        char digits[16];
+        return 8 + (std::to_chars(digits, digits + sizeof(digits), val).ptr - digits);
+    }
+};
+
+// Fixed 4-byte little-endian records
+struct BinaryRecords
+{
+    static constexpr size_t MAX_RECORD = 4;
+
+    static char* format(char* p, int32_t val)
+    {
+        uint32_t u = static_cast<uint32_t>(val);
+        p[0] = static_cast<char>(u);
+        p[1] = static_cast<char>(u >> 8);
+        p[2] = static_cast<char>(u >> 16);
+        p[3] = static_cast<char>(u >> 24);
+        return p + 4;
+    }
+
+    static size_t size(int32_t) { return 4; }
+};
+
+template <typename Buffering, typename Sync, typename Format>
+class BasicFileActions
 {
 private:
     int* fd_;
     int*& fdRef_;
     unsigned int* ref_count_;
-    std::vector<std::pair<std::string, int>> actions_;
+    int* crcFd_;            // Sidecar checksum index, shared like fd_ (-1 when disabled)
+    Sync* sync_;            // Writeback state, shared like fd_ so copies track one offset
+    std::string path_;
+    /* Actions are stored struct-of-arrays: one opcode byte and one operand per
+     * action, so execution streams through two dense arrays and write runs
+     * are plain operand slices. */
+    std::vector<uint8_t> ops_;
+    std::vector<int32_t> operands_;
+    bool verbose_ = true;
+
+    // Per-handle totals, to tell slow files apart from slow action kinds
+    uint64_t executeNs_ = 0;
+    uint64_t bytesWritten_ = 0;
+
+    // Write-run staging, private to this handle (never shared by copies)
+    static constexpr size_t STAGE_CHUNK = StagingPool::CHUNK;
+    static constexpr size_t STAGE_MAX_CHUNKS = 16;
+    static constexpr size_t MAX_RECORD = Format::MAX_RECORD;
+    OutputMode outputMode_ = OUTPUT_WRITE;
+    std::vector<iovec> stage_;
+    WriteProgress lastProgress_;
+
+    /* Optimized form of the action list, built by optimizeActions(): a run
+     * node writes operands_[first, first + count), a close node closes the
+     * fd. Actions with no effect on the file are compacted away first. */
+    enum PlanOp : uint8_t
+    {
+        PLAN_RUN,
+        PLAN_CLOSE
+    };
+    struct PlanNode
+    {
+        PlanOp op;
+        uint32_t first;
+        uint32_t count;
+    };
+    bool optimize_ = false;
+    bool planned_ = false;
+    std::vector<PlanNode> plan_;
+    size_t plannedBytes_ = 0;
+    size_t eliminated_ = 0;
+
+    void closeNow()
+    {
+        // SYSTEM CALL: close
+        if (*fdRef_ != -1) {
+            flushStage();
+            sync_->beforeClose(*fdRef_);
+            commitChecksum();
+            close(*fdRef_);
+            *fdRef_ = -1; // Mark as closed so other copies know
+            if (verbose_)
+                std::cout << "  -> [Close] File closed explicitly.\n";
+        }
+    }
+
+    void executePlan(ThreadStats& stats, std::chrono::steady_clock::time_point& start)
+    {
+        for (const PlanNode& node : plan_) {
+            if (node.op == PLAN_CLOSE) {
+                closeNow();
+            } else if (Buffering::staged(outputMode_)) {
+                if (!stageRun(operands_.data() + node.first, node.count))
+                    perror("  -> [Stage Failed]");
+                flushStage();
+                if (verbose_)
+                    std::cout << "  -> [Run] " << node.count << " writes\n";
+            } else {
+                for (uint32_t i = 0; i < node.count; i++)
+                    writeRecord(operands_[node.first + i], stats);
+            }
+
+            auto end = std::chrono::steady_clock::now();
+            stats.recordAction(node.op == PLAN_CLOSE ? KIND_CLOSE : KIND_WRITE,
+                               std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                               node.op == PLAN_CLOSE ? 1 : node.count);
+            start = end;
+        }
+    }
+
+    // Unstaged write: render the operand as one record and write() it
+    void writeRecord(int val, ThreadStats& stats)
+    {
+        char content[MAX_RECORD];
+        size_t size = Format::format(content, val) - content;
+
+        iovec record = {content, size};
+        WriteProgress progress = writeAll(*fdRef_, &record, 1, false, stats);
+        size_t bytes = progress.written;
+        if (bytes > 0) {
+            bytesWritten_ += bytes;
+            sync_->afterWrite(*fdRef_, bytes);
+            if (*crcFd_ != -1) {
+                batchCrc_ = crc32c(batchCrc_, content, bytes);
+                batchLength_ += bytes;
+            }
+        }
+        lastProgress_ = progress;
+
+        if (progress.error) {
+            errno = progress.error;
+            perror("  -> [Write Failed]");
+        }
+        else if (verbose_)
+            std::cout << "  -> [Write] Wrote " << bytes << " bytes (Value: " << val << ")\n";
+    }
+
+    void executeList(ThreadStats& stats, std::chrono::steady_clock::time_point& actionStart)
+    {
+        const size_t count = ops_.size();
+        for (size_t i = 0; i < count; i++) {
+            uint8_t op = ops_[i];
+            int val = operands_[i];
+            StatKind kind = KIND_OTHER;
+
+            if (op == OP_WRITE && Buffering::staged(outputMode_)) {
+                kind = KIND_WRITE;
+                if (!stageRun(&operands_[i], 1))
+                    perror("  -> [Stage Failed]");
+            }
+            else if (op == OP_WRITE) {
+                kind = KIND_WRITE;
+                writeRecord(val, stats);
+            }
+            else if (op == OP_CLOSE) {
+                kind = KIND_CLOSE;
+                closeNow();
+            }
+            else if (verbose_) {
+                std::cout << "  -> [Action] " << CommandTable::name(op) << " (Simulated val: " << val << ")\n";
+            }
+
+            auto actionEnd = std::chrono::steady_clock::now();
+            stats.recordAction(kind, std::chrono::duration_cast<std::chrono::nanoseconds>(actionEnd - actionStart).count());
+            actionStart = actionEnd;
+        }
+    }
+
+    // Running checksum of the batch currently being written by executeActions()
+    off_t batchOffset_ = 0;
+    size_t batchLength_ = 0;
+    uint32_t batchCrc_ = 0;
+
+    void commitChecksum()
+    {
+        if (*crcFd_ == -1 || batchLength_ == 0)
+            return;
+
+        char line[64];
+        int len = std::snprintf(line, sizeof(line), "%lld %zu %08x\n",
+                                static_cast<long long>(batchOffset_), batchLength_, batchCrc_);
+        if (write(*crcFd_, line, len) != len)
+            perror("  -> [Checksum Failed]");
+
+        batchOffset_ += batchLength_;
+        batchLength_ = 0;
+        batchCrc_ = 0;
+    }
+    void* allocChunk()
+    {
+        /* Gifted pages belong to the pipe until the reader consumes them, so
+         * vmsplice always gets fresh pages; the other modes use the pool. */
+        if (outputMode_ != OUTPUT_VMSPLICE)
+            return StagingPool::instance().acquire();
+        void* chunk = mmap(nullptr, STAGE_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return chunk == MAP_FAILED ? nullptr : chunk;
+    }
+
+    void releaseChunk(void* chunk, bool gifted)
+    {
+        if (gifted)
+            munmap(chunk, STAGE_CHUNK);
+        else
+            StagingPool::instance().release(chunk);
+    }
+
+    /* Format a slice of write operands straight into the staging chunks,
+     * filling each chunk in one tight loop. */
+    bool stageRun(const int32_t* values, size_t count)
+    {
+        size_t i = 0;
+        while (i < count) {
+            if (stage_.empty() || stage_.back().iov_len + MAX_RECORD > STAGE_CHUNK) {
+                if (stage_.size() == STAGE_MAX_CHUNKS && !flushStage())
+                    return false;
+                void* chunk = allocChunk();
+                if (!chunk)
+                    return false;
+                stage_.push_back({chunk, 0});
+            }
+
+            iovec& chunk = stage_.back();
+            char* base = static_cast<char*>(chunk.iov_base);
+            char* p = base + chunk.iov_len;
+            const char* limit = base + STAGE_CHUNK - MAX_RECORD;
+            for (; i < count && p <= limit; i++)
+                p = Format::format(p, values[i]);
+            chunk.iov_len = p - base;
+        }
+        return true;
+    }
+
+    bool flushStage()
+    {
+        if (stage_.empty())
+            return true;
+
+        ThreadStats& stats = StatsRegistry::local();
+        size_t total = 0;
+        for (const iovec& v : stage_)
+            total += v.iov_len;
+
+        // writeAll() advances these in place, so a fallback resumes mid-batch
+        std::vector<iovec> pending = stage_;
+        bool spliced = false;
+        WriteProgress progress;
+        if (outputMode_ == OUTPUT_VMSPLICE) {
+            progress = writeAll(*fdRef_, pending.data(), static_cast<int>(pending.size()), true, stats);
+            spliced = progress.written > 0;
+            if (progress.error == EINVAL || progress.error == ENOSYS) {
+                std::cerr << "  -> [Vmsplice] Not supported on FD " << *fdRef_ << ", falling back to writev\n";
+                outputMode_ = OUTPUT_WRITEV;
+                WriteProgress rest = writeAll(*fdRef_, pending.data(), static_cast<int>(pending.size()), false, stats);
+                rest.requested = progress.requested;
+                rest.written += progress.written;
+                rest.syscalls += progress.syscalls;
+                progress = rest;
+            }
+        } else {
+            progress = writeAll(*fdRef_, pending.data(), static_cast<int>(pending.size()), false, stats);
+        }
+        lastProgress_ = progress;
+
+        bytesWritten_ += progress.written;
+        sync_->afterWrite(*fdRef_, progress.written);
+        if (*crcFd_ != -1) {
+            // Checksum what reached the file, which a short write leaves a prefix of the stage
+            size_t left = progress.written;
+            for (const iovec& v : stage_) {
+                size_t n = std::min(left, v.iov_len);
+                batchCrc_ = crc32c(batchCrc_, v.iov_base, n);
+                left -= n;
+                if (!left)
+                    break;
+            }
+            batchLength_ += progress.written;
+        }
+
+        bool ok = progress.complete();
+        if (!ok) {
+            errno = progress.error;
+            perror("  -> [Flush Failed]");
+        }
+        if (verbose_ || !ok)
+            std::cout << "  -> [" << (spliced ? "Vmsplice" : "Writev") << "] Flushed " << progress.written
+                      << "/" << progress.requested << " bytes in " << stage_.size() << " chunk(s), "
+                      << progress.syscalls << " syscalls (" << progress.shortWrites << " short, "
+                      << progress.interrupts << " EINTR, " << progress.waits << " waits)\n";
+
+        for (const iovec& v : stage_)
+            releaseChunk(v.iov_base, spliced);
+        stage_.clear();
+        return ok;
+    }
 public:
-    FileActions() = delete;
+    BasicFileActions() = delete;
 
-    FileActions(std::string& path)
+    BasicFileActions(std::string& path)
         :   fd_(new int(1)),
             fdRef_(fd_),
-            ref_count_(new unsigned int(1))
+            ref_count_(new unsigned int(1)),
+            crcFd_(new int(-1)),
+            sync_(new Sync()),
+            path_(path)
     {
         
         int new_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
@@ -35,14 +966,114 @@ public:
         }
     }
 
-    FileActions& operator=(const FileActions& other) = delete;
+    /* Adopt an already open descriptor, e.g. the write end of a pipe.
+     * The handle owns it from now on and closes it like any other. */
+    explicit BasicFileActions(int fd)
+        :   BasicFileActions(fd, "fd:" + std::to_string(fd))
+    {
+    }
+
+    BasicFileActions(int fd, const std::string& name)
+        :   fd_(new int(fd)),
+            fdRef_(fd_),
+            ref_count_(new unsigned int(1)),
+            crcFd_(new int(-1)),
+            sync_(new Sync()),
+            path_(name)
+    {
+        std::cout << "[Constructor] Adopted FD " << *fd_ << " (" << path_ << ")\n";
+    }
+
+    /* Hand this handle's descriptor to another process over a Unix domain
+     * socket (SCM_RIGHTS), together with its name. Both sides then share one
+     * open file description, so the descriptor is switched to O_APPEND first:
+     * every write from every process lands atomically at the current end of
+     * file instead of racing on the shared offset. That also means this
+     * handle no longer knows where its batches land, so a checksum index is
+     * closed here: the batches it already lists stay verifiable, later ones
+     * are not recorded. */
+    bool exportTo(int sock)
+    {
+        if (*fdRef_ == -1)
+            return false;
+        flushStage();
+        if (*crcFd_ != -1) {
+            commitChecksum();
+            close(*crcFd_);
+            *crcFd_ = -1;
+            std::cout << "[Checksum] Index for " << path_ << " stopped: shared writers append between batches\n";
+        }
+
+        int flags = fcntl(*fdRef_, F_GETFL);
+        if (flags == -1 || fcntl(*fdRef_, F_SETFL, flags | O_APPEND) == -1) {
+            perror("[Export] O_APPEND");
+            return false;
+        }
+
+        iovec payload = {const_cast<char*>(path_.data()), path_.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr msg = {};
+        msg.msg_iov = &payload;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), fdRef_, sizeof(int));
+
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+            perror("[Export] sendmsg");
+            return false;
+        }
+        return true;
+    }
+
+    /* Receive a handle sent with exportTo(). Returns a handle whose fd is -1
+     * if nothing usable arrived. */
+    static BasicFileActions importFrom(int sock)
+    {
+        char name[256];
+        iovec payload = {name, sizeof(name)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr msg = {};
+        msg.msg_iov = &payload;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        int fd = -1;
+        cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        else
+            std::cerr << "[Import] No descriptor received" << std::endl;
+
+        return BasicFileActions(fd, n > 0 ? std::string(name, n) : std::string("fd:-1"));
+    }
+
+    BasicFileActions& operator=(const BasicFileActions& other) = delete;
 
 
-    FileActions(const FileActions& other)
+    BasicFileActions(const BasicFileActions& other)
         :   fd_(other.fd_),
             fdRef_(fd_),
             ref_count_(other.ref_count_),
-            actions_(other.actions_)
+            crcFd_(other.crcFd_),
+            sync_(other.sync_),
+            path_(other.path_),
+            ops_(other.ops_),
+            operands_(other.operands_),
+            verbose_(other.verbose_),
+            outputMode_(other.outputMode_),
+            optimize_(other.optimize_),
+            planned_(other.planned_),
+            plan_(other.plan_),
+            plannedBytes_(other.plannedBytes_),
+            eliminated_(other.eliminated_)
     {
         if (ref_count_) { 
             (*ref_count_)++; 
@@ -50,11 +1081,190 @@ public:
         }
     }
 
+    /* Select how write runs are emitted. OUTPUT_VMSPLICE is only honoured for
+     * pipes (anything else gets OUTPUT_WRITEV); the pipe is also enlarged so a
+     * whole staging batch fits without blocking half way. */
+    OutputMode setOutputMode(OutputMode mode)
+    {
+        flushStage();
+        if (mode == OUTPUT_VMSPLICE) {
+            struct stat st;
+            if (*fdRef_ == -1 || fstat(*fdRef_, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+                mode = OUTPUT_WRITEV;
+            } else {
+                fcntl(*fdRef_, F_SETPIPE_SZ, static_cast<int>(STAGE_CHUNK * STAGE_MAX_CHUNKS));
+            }
+        }
+        outputMode_ = mode;
+        return mode;
+    }
+
+    void printFileStats(std::ostream& out) const
+    {
+        out << "[Stats] " << path_ << ": " << bytesWritten_ << " bytes in "
+            << executeNs_ / 1000 << " us of executeActions\n";
+    }
+
+    /* Record a CRC32C for every executeActions() batch in "<path>.crc32c".
+     * Each line is "<offset> <length> <crc32c hex>", so a reader can verify
+     * any batch without touching the rest of the file. Not available on an
+     * O_APPEND descriptor (e.g. one shared with exportTo/importFrom), where
+     * other writers move the end of file between our writes. */
+    bool enableChecksums()
+    {
+        if (*crcFd_ != -1)
+            return true;
+        int flags = *fdRef_ == -1 ? -1 : fcntl(*fdRef_, F_GETFL);
+        if (flags != -1 && (flags & O_APPEND)) {
+            std::cerr << "[Error] Checksums need exclusive offsets, " << path_ << " is shared (O_APPEND)\n";
+            return false;
+        }
+
+        std::string indexPath = path_ + ".crc32c";
+        *crcFd_ = open(indexPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (*crcFd_ == -1) {
+            std::cerr << "[Error] Failed to open checksum index: " << indexPath << std::endl;
+            return false;
+        }
+        std::cout << "[Checksum] CRC32C index " << indexPath
+                  << (crc32cHardwareAvailable() ? " (hardware)\n" : " (software)\n");
+        return true;
+    }
+
+    /* Re-read a file and its sidecar index, returns false on any mismatch */
+    static bool verifyChecksums(const std::string& path)
+    {
+        std::string indexPath = path + ".crc32c";
+        FILE* index = std::fopen(indexPath.c_str(), "r");
+        int fd = open(path.c_str(), O_RDONLY);
+        if (!index || fd == -1) {
+            std::cerr << "[Verify] Cannot open " << path << " or its index" << std::endl;
+            if (index) std::fclose(index);
+            if (fd != -1) close(fd);
+            return false;
+        }
+
+        struct stat st;
+        fstat(fd, &st);
+        const unsigned char* data = nullptr;
+        if (st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = (map == MAP_FAILED) ? nullptr : static_cast<const unsigned char*>(map);
+        }
+
+        bool ok = true;
+        unsigned batches = 0;
+        long long offset;
+        size_t length;
+        unsigned int expected;
+        while (std::fscanf(index, "%lld %zu %x", &offset, &length, &expected) == 3) {
+            batches++;
+            if (!data || offset < 0 || offset + static_cast<long long>(length) > st.st_size) {
+                std::cerr << "[Verify] Batch at " << offset << " is past end of file\n";
+                ok = false;
+                continue;
+            }
+            uint32_t actual = crc32c(0, data + offset, length);
+            if (actual != expected) {
+                std::cerr << "[Verify] CRC mismatch in batch at " << offset << "\n";
+                ok = false;
+            }
+        }
+
+        if (data) munmap(const_cast<unsigned char*>(data), st.st_size);
+        std::fclose(index);
+        close(fd);
+        std::cout << "[Verify] " << path << ": " << batches << " batches, " << (ok ? "OK" : "CORRUPT") << "\n";
+        return ok;
+    }
+
     void registerActions(std::initializer_list<std::pair<std::string, int>> actions)
     {
-        actions_ = actions;
+        clearActions();
+        reserveActions(actions.size());
+        for (const auto& action : actions) {
+            uint8_t op = CommandTable::intern(action.first);
+            if (op == OP_INVALID) {
+                std::cerr << "Cannot register action \"" << action.first << "\": too many distinct commands\n";
+                continue;
+            }
+            appendAction(op, action.second);
+        }
+        finishActions();
+    }
+
+    /* Incremental registration for loaders: clearActions() keeps the vector's
+     * capacity so refilling it chunk after chunk does not reallocate, and
+     * finishActions() marks the list complete. */
+    void clearActions() { ops_.clear(); operands_.clear(); planned_ = false; }
+    void reserveActions(size_t count) { ops_.reserve(count); operands_.reserve(count); }
+    void appendAction(uint8_t op, int val) { ops_.push_back(op); operands_.push_back(val); planned_ = false; }
+    void finishActions()
+    {
+        if (optimize_)
+            optimizeActions();
     }
 
+    /* With optimization on, every registered list goes through a peephole
+     * pass (see optimizeActions). File output is byte-identical; only the
+     * console trace of simulated actions is dropped. */
+    void setOptimize(bool optimize) { optimize_ = optimize; }
+    size_t actionCount() const { return ops_.size(); }
+    size_t actionMemory() const { return ops_.capacity() * sizeof(uint8_t) + operands_.capacity() * sizeof(int32_t); }
+    size_t plannedBytes() const { return planned_ ? plannedBytes_ : 0; }
+    size_t eliminatedActions() const { return planned_ ? eliminated_ : 0; }
+
+    /* Peephole pass over the action list, compacting ops_/operands_ in place:
+     *  - everything after the first close is dead (writes would fail with
+     *    EBADF, repeated closes are no-ops),
+     *  - simulated actions never touch the file and are dropped, along
+     *    with their console trace,
+     *  - adjacent writes merge into one run node, flushed as one batch
+     *    (or written record by record when Buffering does not stage),
+     *  - the total output size is summed up front. */
+    void optimizeActions()
+    {
+        const size_t original = ops_.size();
+        plan_.clear();
+        plannedBytes_ = 0;
+
+        size_t kept = 0;
+        for (size_t i = 0; i < original; i++) {
+            uint8_t op = ops_[i];
+            if (op == OP_WRITE) {
+                if (plan_.empty() || plan_.back().op != PLAN_RUN)
+                    plan_.push_back({PLAN_RUN, static_cast<uint32_t>(kept), 0});
+                plan_.back().count++;
+                plannedBytes_ += Format::size(operands_[i]);
+            } else if (op == OP_CLOSE) {
+                plan_.push_back({PLAN_CLOSE, static_cast<uint32_t>(kept), 1});
+            } else {
+                continue;
+            }
+            ops_[kept] = op;
+            operands_[kept] = operands_[i];
+            kept++;
+            if (op == OP_CLOSE)
+                break;
+        }
+        ops_.resize(kept);
+        operands_.resize(kept);
+
+        eliminated_ = original - kept;
+        planned_ = true;
+        if (verbose_)
+            std::cout << "[Optimizer] " << original << " actions -> " << plan_.size()
+                      << " nodes, " << eliminated_ << " eliminated, " << plannedBytes_ << " bytes planned\n";
+    }
+
+    // Per-action console output is far too slow for bulk scripts
+    void setVerbose(bool verbose) { verbose_ = verbose; }
+
+    const Sync& syncPolicy() const { return *sync_; }
+
+    // Progress of the most recent write or staged flush
+    const WriteProgress& lastProgress() const { return lastProgress_; }
+
     void executeActions()
     {
         // Check if pointer is valid and file is open
@@ -63,39 +1273,35 @@ public:
             return;
         }
         
-        std::cout << "Executing actions on File Descriptor " << *fdRef_ << ":" << std::endl;
-        
-        for (const auto& action : actions_) {
-            std::string cmd = action.first;
-            int val = action.second;
+        if (verbose_)
+            std::cout << "Executing actions on File Descriptor " << *fdRef_ << ":" << std::endl;
 
-            if (cmd == "write") {
-                // Convert int to string + newline
-                std::string content = "Value: " + std::to_string(val) + "\n";
-                
-                ssize_t bytes = write(*fdRef_, content.c_str(), content.size());
-                
-                if (bytes != -1)
-                    std::cout << "  -> [Write] Wrote " << bytes << " bytes (Value: " << val << ")\n";
-                else
-                    perror("  -> [Write Failed]");
-            }
-            else if (cmd == "close") {
-                // SYSTEM CALL: close
-                if (*fdRef_ != -1) {
-                    close(*fdRef_);
-                    *fdRef_ = -1; // Mark as closed so other copies know
-                    std::cout << "  -> [Close] File closed explicitly.\n";
-                }
-            }
-            else {
-                std::cout << "  -> [Action] " << cmd << " (Simulated val: " << val << ")\n";
-            }
-        }
+        if (*crcFd_ != -1)
+            batchOffset_ = lseek(*fdRef_, 0, SEEK_CUR);
+
+        ThreadStats& stats = StatsRegistry::local();
+        auto batchStart = std::chrono::steady_clock::now();
+        auto actionStart = batchStart;
+
+        if (planned_)
+            executePlan(stats, actionStart);
+        else
+            executeList(stats, actionStart);
+
+        flushStage();
+        if (*fdRef_ != -1)
+            sync_->afterBatch(*fdRef_);
+        commitChecksum();
+        auto batchEnd = std::chrono::steady_clock::now();
+        stats.recordAction(KIND_FLUSH, std::chrono::duration_cast<std::chrono::nanoseconds>(batchEnd - actionStart).count());
+        executeNs_ += std::chrono::duration_cast<std::chrono::nanoseconds>(batchEnd - batchStart).count();
     }
     
     
-    ~FileActions() {
+    ~BasicFileActions() {
+        if (fd_ && *fd_ != -1)
+            flushStage();
+
         if (ref_count_) {
             (*ref_count_)--; // Decrement the counter
             
@@ -104,12 +1310,17 @@ public:
                 // Only close if it hasn't been closed yet
                 if (fd_ && *fd_ != -1) {
                     std::cout << "[Destructor] Closing file descriptor " << *fd_ << "...\n";
+                    sync_->beforeClose(*fd_);
                     close(*fd_);
                 }
+                if (*crcFd_ != -1)
+                    close(*crcFd_);
                 
                 std::cout << "[Destructor] Ref count is 0. Deleting heap memory.\n";
                 delete fd_;        // Delete the int holder
                 delete ref_count_; // Delete the counter
+                delete crcFd_;
+                delete sync_;
                 fd_ = nullptr;
                 ref_count_ = nullptr;
             } 
@@ -121,10 +1332,732 @@ public:
     }
 };
 
-int main() {
+// Today's behaviour: output mode chosen at runtime, no syncing, text records
+using FileActions = BasicFileActions<RuntimeBuffering, NoSync, TextRecords>;
+
+// Bounded page-cache footprint for very large outputs
+using StreamingFileActions = BasicFileActions<StagedWrites, StreamingSync<>, TextRecords>;
+
+/* Action script loader: one "cmd value" pair per line, '#' starts a comment.
+ * The script is mmap'ed and parsed in place with string_view/from_chars, and
+ * handed to FileActions a bounded chunk at a time, so a script with tens of
+ * millions of lines never needs more than one chunk of actions in memory. */
+class ActionScript
+{
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t pos_ = 0;
+    size_t released_ = 0;   // Prefix of the mapping already handed back to the kernel
+    size_t line_ = 0;
+    size_t errors_ = 0;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    // Drop pages behind the cursor so resident memory stays bounded as well
+    void releaseConsumed()
+    {
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        size_t end = pos_ & ~(page - 1);
+        if (end >= released_ + (64u << 20)) {
+            madvise(const_cast<char*>(data_) + released_, end - released_, MADV_DONTNEED);
+            released_ = end;
+        }
+    }
+public:
+    explicit ActionScript(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            std::cerr << "[Error] Failed to open script: " << path << std::endl;
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                data_ = static_cast<const char*>(map);
+                size_ = st.st_size;
+                madvise(map, size_, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd); // The mapping keeps the file alive
+    }
+
+    ActionScript(const ActionScript&) = delete;
+    ActionScript& operator=(const ActionScript&) = delete;
+
+    ~ActionScript()
+    {
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+    }
+
+    bool isOpen() const { return data_ != nullptr; }
+    size_t errors() const { return errors_; }
+
+    /* Replace file's action list with up to maxActions parsed actions.
+     * Returns the number of actions loaded, 0 once the script is exhausted. */
+    template <typename FileT>
+    size_t nextChunk(FileT& file, size_t maxActions)
+    {
+        file.clearActions();
+        file.reserveActions(maxActions);
+
+        size_t count = 0;
+        while (count < maxActions && pos_ < size_) {
+            const char* nl = static_cast<const char*>(std::memchr(data_ + pos_, '\n', size_ - pos_));
+            size_t end = nl ? static_cast<size_t>(nl - data_) : size_;
+            std::string_view line(data_ + pos_, end - pos_);
+            pos_ = end + 1;
+            line_++;
+
+            size_t hash = line.find('#');
+            if (hash != std::string_view::npos)
+                line = line.substr(0, hash);
+
+            size_t i = 0;
+            while (i < line.size() && isSpace(line[i])) i++;
+            if (i == line.size())
+                continue;
+
+            size_t cmdStart = i;
+            while (i < line.size() && !isSpace(line[i])) i++;
+            std::string_view cmd = line.substr(cmdStart, i - cmdStart);
+            while (i < line.size() && isSpace(line[i])) i++;
+
+            int val = 0;
+            const char* first = line.data() + i;
+            const char* last = line.data() + line.size();
+            std::from_chars_result res = std::from_chars(first, last, val);
+            while (res.ptr < last && isSpace(*res.ptr)) res.ptr++;
+            if (res.ec != std::errc() || res.ptr != last) {
+                if (errors_++ < 10)
+                    std::cerr << "[Script] Line " << line_ << ": expected \"cmd value\"\n";
+                continue;
+            }
+
+            uint8_t op = CommandTable::intern(cmd);
+            if (op == OP_INVALID) {
+                if (errors_++ < 10)
+                    std::cerr << "[Script] Line " << line_ << ": too many distinct commands\n";
+                continue;
+            }
+            file.appendAction(op, val);
+            count++;
+        }
+        file.finishActions();
+
+        releaseConsumed();
+        return count;
+    }
+};
+
+/* Shares execution time between many FileActions lists. Each submitted list
+ * is cut into slices of at most maxSlice actions, and slices run one at a
+ * time in order of higher priority, then earliest deadline within a
+ * priority (lists without one come last in their class), then round-robin
+ * among equals. A deadline therefore never lifts a list above a higher
+ * priority one, and a huge low-priority list only holds the file for one
+ * slice before a small urgent list gets its turn. run() serves lists as
+ * they are submitted, from any thread, until stop(); a finished list's slot
+ * is reused by the next one. Completion latency is recorded per priority
+ * class. */
+class IoScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+private:
+    struct Job
+    {
+        FileActions* file;
+        std::vector<uint8_t> ops;
+        std::vector<int32_t> operands;
+        size_t next = 0;
+        int priority;
+        Clock::time_point deadline;
+        Clock::time_point submitted;
+    };
+
+    struct Ticket
+    {
+        Clock::time_point deadline;
+        int priority;
+        uint64_t turn;
+        size_t job;
+
+        // priority_queue pops the largest, so "larger" means "runs later"
+        bool operator<(const Ticket& other) const
+        {
+            if (priority != other.priority)
+                return priority < other.priority;
+            if (deadline != other.deadline)
+                return deadline > other.deadline;
+            return turn > other.turn;
+        }
+    };
+
+    size_t maxSlice_;
+    std::mutex mutex_;          // Guards jobs_ (growth only), freeJobs_, ready_ and stopping_
+    std::condition_variable submitted_;
+    std::deque<Job> jobs_;      // Stable addresses while other threads submit
+    std::vector<size_t> freeJobs_;  // Finished slots in jobs_, reused by submit()
+    std::priority_queue<Ticket> ready_;
+    uint64_t turn_ = 0;
+    bool stopping_ = false;
+    std::map<int, std::vector<double>> latencyUs_;  // Per priority class
+    std::map<int, unsigned> missed_;
+public:
+    static constexpr Clock::time_point NO_DEADLINE = Clock::time_point::max();
+
+    explicit IoScheduler(size_t maxSlice = 4096) : maxSlice_(maxSlice ? maxSlice : 1) {}
+
+    void submit(FileActions& file, std::vector<uint8_t> ops, std::vector<int32_t> operands,
+                int priority, Clock::time_point deadline = NO_DEADLINE)
+    {
+        Job job;
+        job.file = &file;
+        job.ops = std::move(ops);
+        job.operands = std::move(operands);
+        job.priority = priority;
+        job.deadline = deadline;
+        job.submitted = Clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t index;
+            if (!freeJobs_.empty()) {
+                index = freeJobs_.back();
+                freeJobs_.pop_back();
+                jobs_[index] = std::move(job);
+            } else {
+                index = jobs_.size();
+                jobs_.push_back(std::move(job));
+            }
+            ready_.push({deadline, priority, turn_++, index});
+        }
+        submitted_.notify_one();
+    }
+
+    // Let run() return once every list submitted so far has executed
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        submitted_.notify_one();
+    }
+
+    // Execute lists as they are submitted, sleeping while there are none,
+    // until stop() and everything submitted has executed completely
+    void run()
+    {
+        for (;;) {
+            Ticket ticket;
+            Job* jobPtr;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                submitted_.wait(lock, [this]() { return !ready_.empty() || stopping_; });
+                if (ready_.empty())
+                    return;
+                ticket = ready_.top();
+                ready_.pop();
+                jobPtr = &jobs_[ticket.job];
+            }
+            Job& job = *jobPtr;
+
+            size_t end = std::min(job.ops.size(), job.next + maxSlice_);
+            job.file->clearActions();
+            job.file->reserveActions(end - job.next);
+            for (size_t i = job.next; i < end; i++)
+                job.file->appendAction(job.ops[i], job.operands[i]);
+            job.file->finishActions();
+            job.file->executeActions();
+            job.next = end;
+
+            if (job.next < job.ops.size()) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                ticket.turn = turn_++;
+                ready_.push(ticket);
+                continue;
+            }
+
+            Clock::time_point done = Clock::now();
+            latencyUs_[job.priority].push_back(std::chrono::duration<double, std::micro>(done - job.submitted).count());
+            if (job.deadline != NO_DEADLINE && done > job.deadline)
+                missed_[job.priority]++;
+            job.ops = std::vector<uint8_t>();
+            job.operands = std::vector<int32_t>();
+            std::lock_guard<std::mutex> lock(mutex_);
+            freeJobs_.push_back(ticket.job);
+        }
+    }
+
+    void printLatency(std::ostream& out)
+    {
+        for (auto& entry : latencyUs_) {
+            std::vector<double>& samples = entry.second;
+            std::sort(samples.begin(), samples.end());
+            auto pct = [&](double p) { return samples[static_cast<size_t>(p * (samples.size() - 1))]; };
+            out << "[Scheduler] priority " << entry.first << ": " << samples.size() << " lists, p50 "
+                << pct(0.50) << " us, p90 " << pct(0.90) << " us, p99 " << pct(0.99) << " us, max "
+                << samples.back() << " us, " << missed_[entry.first] << " deadlines missed\n";
+        }
+    }
+};
+
+/* Checksum throughput over an in-memory buffer, hardware vs. portable path */
+int benchCrc32c()
+{
+    const size_t size = 256u << 20;
+    std::vector<unsigned char> buffer(size);
+    for (size_t i = 0; i < size; i++)
+        buffer[i] = static_cast<unsigned char>(i * 2654435761u >> 24);
+
+    auto run = [&](const char* name, uint32_t (*fn)(uint32_t, const unsigned char*, size_t)) {
+        auto start = std::chrono::steady_clock::now();
+        uint32_t crc = ~fn(~0u, buffer.data(), size);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << name << ": " << (size / sec) / 1e9 << " GB/s (crc " << std::hex << crc << std::dec << ")\n";
+    };
+
+    std::cout << "CRC32C over " << (size >> 20) << " MiB\n";
+    run("software", crc32cSoftware);
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+    if (crc32cHardwareAvailable())
+        run("hardware", crc32cHardware);
+#endif
+    return crc32c(0, "123456789", 9) == 0xE3069283u ? 0 : 1;
+}
+
+/* Throughput into a consumer process reading the other end of a pipe.
+ * With nonBlocking the producer end is O_NONBLOCK and the consumer reads in
+ * small pieces, which exercises the short-write and EAGAIN paths. */
+int benchPipe(size_t count, bool nonBlocking)
+{
+    const OutputMode modes[] = {OUTPUT_WRITE, OUTPUT_WRITEV, OUTPUT_VMSPLICE};
+    const char* const names[] = {"write", "writev", "vmsplice"};
+
+    std::cout << "Pipe throughput, " << count << " write actions\n";
+    for (int m = 0; m < 3; m++) {
+        size_t actions = (modes[m] == OUTPUT_WRITE) ? count / 10 : count;
+        int fds[2];
+        if (pipe(fds) == -1) {
+            perror("pipe");
+            return 1;
+        }
+
+        std::cout.flush(); // The child must not inherit and replay buffered output
+        pid_t child = fork();
+        if (child == 0) {
+            close(fds[1]);
+            static char buf[1 << 20];
+            size_t received = 0;
+            uint32_t crc = 0;
+            ssize_t n;
+            while ((n = read(fds[0], buf, nonBlocking ? 4096 : sizeof(buf))) > 0) {
+                crc = crc32c(crc, buf, n);
+                received += n;
+            }
+            std::printf("  [Consumer] %zu bytes, crc32c %08x\n", received, crc);
+            std::fflush(stdout);
+            _exit(0);
+        }
+        close(fds[0]);
+        if (nonBlocking)
+            fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            FileActions producer(fds[1]);
+            producer.setVerbose(false);
+            OutputMode actual = producer.setOutputMode(modes[m]);
+            for (size_t done = 0; done < actions; ) {
+                size_t chunk = std::min<size_t>(actions - done, 1 << 16);
+                producer.clearActions();
+                for (size_t i = 0; i < chunk; i++)
+                    producer.appendAction(OP_WRITE, static_cast<int>(done + i));
+                producer.executeActions();
+                done += chunk;
+            }
+            if (actual != modes[m])
+                std::cout << "  (" << names[m] << " unavailable, used " << names[actual] << ")\n";
+        }
+        waitpid(child, nullptr, 0);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << names[m] << ": " << actions << " actions in " << sec << " s, "
+                  << actions / sec / 1e6 << " M actions/s\n";
+    }
+    collectStats().print(std::cout);
+    return 0;
+}
+
+/* Execution speed and memory per action for a large list, written to
+ * /dev/null so only the action path itself is measured */
+int benchActions(size_t count)
+{
+    std::string sink = "/dev/null";
+    FileActions file(sink);
+    file.setVerbose(false);
+    file.setOutputMode(OUTPUT_WRITEV);
+
+    auto seconds = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+    };
+
+    auto fill = [&]() {
+        file.clearActions();
+        file.reserveActions(count);
+        for (size_t i = 0; i < count; i++)
+            file.appendAction(i % 64 == 63 ? OP_FIRST_CUSTOM : OP_WRITE, static_cast<int>(i));
+        file.finishActions();
+    };
+
+    CommandTable::intern("mark"); // OP_FIRST_CUSTOM
+    auto start = std::chrono::steady_clock::now();
+    fill();
+    std::cout << "Actions: " << count << ", filled in " << seconds(start) << " s\n";
+    std::cout << "  memory/action: " << static_cast<double>(file.actionMemory()) / count
+              << " bytes (vs " << sizeof(std::pair<std::string, int>) << " for pair<string,int>)\n";
+
+    start = std::chrono::steady_clock::now();
+    file.executeActions();
+    double sec = seconds(start);
+    std::cout << "  list execute: " << sec << " s, " << sec * 1e9 / count << " ns/action\n";
+
+    file.setOptimize(true);
+    fill();
+    start = std::chrono::steady_clock::now();
+    file.executeActions();
+    sec = seconds(start);
+    std::cout << "  plan execute: " << sec << " s, " << sec * 1e9 / count << " ns/action ("
+              << file.eliminatedActions() << " eliminated)\n";
+    return 0;
+}
+
+/* One policy combination: `batches` executeActions() calls of `perBatch`
+ * write actions each, into a scratch file */
+template <typename FileT>
+void benchPolicy(const char* name, size_t batches, size_t perBatch)
+{
+    std::string path = "policy_bench.out";
+    double sec;
+    {
+        FileT file(path);
+        file.setVerbose(false);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t b = 0; b < batches; b++) {
+            file.clearActions();
+            for (size_t i = 0; i < perBatch; i++)
+                file.appendAction(OP_WRITE, static_cast<int>(b * perBatch + i));
+            file.executeActions();
+        }
+        sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    struct stat st;
+    stat(path.c_str(), &st);
+    unlink(path.c_str());
+    std::cout << "  " << name << ": " << sec * 1e9 / (batches * perBatch) << " ns/action, "
+              << st.st_size << " bytes\n";
+}
+
+int benchPolicies(size_t count)
+{
+    const size_t perBatch = 4096;
+    const size_t batches = count / perBatch ? count / perBatch : 1;
+    std::cout << "Policies, " << batches << " batches x " << perBatch << " writes\n";
+    benchPolicy<BasicFileActions<UnbufferedWrites, NoSync, TextRecords>>("unbuffered/nosync/text", batches / 8 + 1, perBatch);
+    benchPolicy<BasicFileActions<StagedWrites, NoSync, TextRecords>>("staged/nosync/text", batches, perBatch);
+    benchPolicy<BasicFileActions<StagedWrites, NoSync, BinaryRecords>>("staged/nosync/binary", batches, perBatch);
+    benchPolicy<BasicFileActions<StagedWrites, SyncPerBatch, TextRecords>>("staged/batch-sync/text", batches, perBatch);
+    benchPolicy<BasicFileActions<StagedWrites, SyncOnClose, BinaryRecords>>("staged/close-sync/binary", batches, perBatch);
+    return 0;
+}
+
+// System-wide Dirty + Writeback from /proc/meminfo, in KiB
+static long dirtyKiB()
+{
+    FILE* f = std::fopen("/proc/meminfo", "r");
+    if (!f)
+        return -1;
+    char line[128];
+    long total = 0;
+    long kib;
+    while (std::fgets(line, sizeof(line), f)) {
+        if (std::sscanf(line, "Dirty: %ld kB", &kib) == 1 || std::sscanf(line, "Writeback: %ld kB", &kib) == 1)
+            total += kib;
+    }
+    std::fclose(f);
+    return total;
+}
+
+template <typename FileT>
+void benchStreamingRun(const char* name, size_t megabytes)
+{
+    std::string path = "streaming_bench.out";
+    const size_t perBatch = 64 * 1024;  // ~900 KiB of text per batch
+    long baseline = dirtyKiB();
+    long peak = baseline;
+    size_t written = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        FileT file(path);
+        file.setVerbose(false);
+        for (int v = 0; written < (megabytes << 20); ) {
+            file.clearActions();
+            for (size_t i = 0; i < perBatch; i++)
+                file.appendAction(OP_WRITE, v++);
+            file.executeActions();
+            struct stat st;
+            stat(path.c_str(), &st);
+            written = st.st_size;
+            peak = std::max(peak, dirtyKiB());
+        }
+        if constexpr (std::is_same_v<FileT, StreamingFileActions>)
+            std::cout << "  " << name << ": own dirty high-water " << (file.syncPolicy().dirtyHighWater() >> 10) << " KiB\n";
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    unlink(path.c_str());
+    std::cout << "  " << name << ": " << (written >> 20) / sec << " MiB/s, system dirty peak +"
+              << peak - baseline << " KiB\n";
+}
+
+int benchStreaming(size_t megabytes)
+{
+    std::cout << "Streaming " << megabytes << " MiB\n";
+    benchStreamingRun<BasicFileActions<StagedWrites, NoSync, TextRecords>>("buffered", megabytes);
+    benchStreamingRun<StreamingFileActions>("streaming", megabytes);
+    return 0;
+}
+
+// dTLB load-miss counter for this process, -1 when perf events are unavailable
+static int openTlbCounter()
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+/* Page faults and dTLB misses for repeated staged executeActions() calls.
+ * Each configuration runs in its own child so the pool starts empty. */
+int benchStaging(size_t rounds)
+{
+    struct Config
+    {
+        const char* name;
+        bool pooling;
+        bool hugePages;
+    };
+    const Config configs[] = {
+        {"fresh mmap per chunk", false, false},
+        {"pool, 4 KiB pages", true, false},
+        {"pool, hugepages", true, true},
+    };
+    const char* const backings[] = {"hugetlb", "thp", "4k"};
+
+    std::cout << "Staging buffers, " << rounds << " rounds of 64K writes\n";
+    for (const Config& config : configs) {
+        std::cout.flush();
+        pid_t child = fork();
+        if (child == 0) {
+            StagingPool::instance().setPooling(config.pooling);
+            StagingPool::instance().setHugePages(config.hugePages);
+
+            std::string sink = "/dev/null";
+            FileActions file(sink);
+            file.setVerbose(false);
+            file.setOutputMode(OUTPUT_WRITEV);
+            file.reserveActions(64 * 1024);
+
+            int tlb = openTlbCounter();
+            rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < rounds; r++) {
+                file.clearActions();
+                for (int i = 0; i < 64 * 1024; i++)
+                    file.appendAction(OP_WRITE, i);
+                file.executeActions();
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            getrusage(RUSAGE_SELF, &after);
+            long long misses = -1;
+            if (tlb == -1 || read(tlb, &misses, sizeof(misses)) != sizeof(misses))
+                misses = -1;
+
+            std::string tlbText = misses < 0 ? "n/a" : std::to_string(misses);
+            std::printf("  %-22s %8.3f s, %7ld minor faults, dTLB misses %s (%s)\n", config.name, sec,
+                        after.ru_minflt - before.ru_minflt, tlbText.c_str(),
+                        config.pooling ? backings[StagingPool::instance().backing()] : "-");
+            std::fflush(stdout);
+            _exit(0);
+        }
+        waitpid(child, nullptr, 0);
+    }
+    return 0;
+}
+
+/* Worker processes appending to one output through an fd received over
+ * SCM_RIGHTS, compared with each worker reopening the file by path */
+int benchShare(int workers)
+{
+    const int perWorker = 100000;
+    std::string path = "share_bench.out";
+    FileActions owner(path);
+    owner.setVerbose(false);
+
+    std::cout << "Sharing " << path << " with " << workers << " workers\n";
+    std::vector<pid_t> children;
+    for (int w = 0; w < workers; w++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+            perror("socketpair");
+            return 1;
+        }
+        owner.exportTo(sv[0]); // Queued in the socket until the worker reads it
+        close(sv[0]);
+
+        std::cout.flush();
+        pid_t child = fork();
+        if (child == 0) {
+            auto t0 = std::chrono::steady_clock::now();
+            FileActions shared = FileActions::importFrom(sv[1]);
+            auto t1 = std::chrono::steady_clock::now();
+            int reopened = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            auto t2 = std::chrono::steady_clock::now();
+            close(reopened);
+
+            shared.setVerbose(false);
+            shared.setOutputMode(OUTPUT_WRITEV);
+            for (int i = 0; i < perWorker; i++)
+                shared.appendAction(OP_WRITE, w * perWorker + i);
+            shared.executeActions();
+
+            std::printf("  worker %d: import %.1f us, reopen by path %.1f us\n", w,
+                        std::chrono::duration<double, std::micro>(t1 - t0).count(),
+                        std::chrono::duration<double, std::micro>(t2 - t1).count());
+            std::fflush(stdout);
+            _exit(shared.lastProgress().complete() ? 0 : 1);
+        }
+        close(sv[1]);
+        children.push_back(child);
+    }
+
+    int failed = 0;
+    for (pid_t child : children) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    // Every record must have landed whole: count complete lines
+    FILE* f = std::fopen(path.c_str(), "r");
+    size_t lines = 0;
+    char line[64];
+    while (f && std::fgets(line, sizeof(line), f))
+        lines += std::strncmp(line, "Value: ", 7) == 0;
+    if (f)
+        std::fclose(f);
+    unlink(path.c_str());
+
+    std::cout << "  " << lines << "/" << static_cast<size_t>(workers) * perWorker << " records intact, "
+              << failed << " workers failed\n";
+    return failed ? 1 : 0;
+}
+
+/* A bulk low-priority list is running when small urgent lists start to
+ * arrive, one per millisecond from this thread while run() works on
+ * another, and keep arriving after the bulk list is done. With unbounded slices
+ * they queue behind the whole bulk list; with bounded slices each waits for
+ * at most one slice. */
+int benchScheduler(size_t bulk)
+{
+    const int urgentLists = 100;
+    const size_t urgentSize = 100;
+    std::string sink = "/dev/null";
+    FileActions bulkFile(sink);
+    FileActions urgentFile(sink);
+    for (FileActions* f : {&bulkFile, &urgentFile}) {
+        f->setVerbose(false);
+        f->setOutputMode(OUTPUT_WRITEV);
+    }
+
+    for (size_t slice : {bulk, static_cast<size_t>(4096)}) {
+        std::cout << "Scheduler, slices of " << slice << " actions\n";
+        IoScheduler scheduler(slice);
+        scheduler.submit(bulkFile, std::vector<uint8_t>(bulk, OP_WRITE), std::vector<int32_t>(bulk, 7), 0);
+
+        std::thread worker([&]() { scheduler.run(); });
+        for (int i = 0; i < urgentLists; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            scheduler.submit(urgentFile, std::vector<uint8_t>(urgentSize, OP_WRITE),
+                             std::vector<int32_t>(urgentSize, i), 10,
+                             IoScheduler::Clock::now() + std::chrono::milliseconds(5));
+        }
+        scheduler.stop();
+        worker.join();
+        scheduler.printLatency(std::cout);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench-crc")
+        return benchCrc32c();
+    if (argc > 1 && std::string(argv[1]) == "--bench-actions")
+        return benchActions(argc > 2 ? std::stoul(argv[2]) : 10000000);
+    if (argc > 1 && std::string(argv[1]) == "--bench-policies")
+        return benchPolicies(argc > 2 ? std::stoul(argv[2]) : 1000000);
+    if (argc > 1 && std::string(argv[1]) == "--bench-streaming")
+        return benchStreaming(argc > 2 ? std::stoul(argv[2]) : 1024);
+    if (argc > 1 && std::string(argv[1]) == "--bench-staging")
+        return benchStaging(argc > 2 ? std::stoul(argv[2]) : 200);
+    if (argc > 1 && std::string(argv[1]) == "--bench-share")
+        return benchShare(argc > 2 ? std::stoi(argv[2]) : 4);
+    if (argc > 1 && std::string(argv[1]) == "--bench-scheduler")
+        return benchScheduler(argc > 2 ? std::stoul(argv[2]) : 4000000);
+    if (argc > 1 && std::string(argv[1]) == "--bench-pipe")
+        return benchPipe(argc > 2 ? std::stoul(argv[2]) : 10000000, argc > 3 && std::string(argv[3]) == "--nonblock");
+    if (argc > 2 && std::string(argv[1]) == "--verify")
+        return FileActions::verifyChecksums(argv[2]) ? 0 : 1;
+    if (argc > 3 && std::string(argv[1]) == "--run-script") {
+        ActionScript script(argv[2]);
+        if (!script.isOpen())
+            return 1;
+
+        std::string output = argv[3];
+        FileActions file(output);
+        file.setVerbose(false);
+        file.setOptimize(argc > 4 && std::string(argv[4]) == "--optimize");
+
+        size_t total = 0;
+        auto start = std::chrono::steady_clock::now();
+        size_t eliminated = 0;
+        size_t planned = 0;
+        while (size_t n = script.nextChunk(file, 64 * 1024)) {
+            eliminated += file.eliminatedActions();
+            planned += file.plannedBytes();
+            file.executeActions();
+            total += n;
+        }
+        if (planned)
+            std::cout << "[Optimizer] " << eliminated << " actions eliminated, " << planned << " bytes planned\n";
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "[Script] " << total << " actions in " << sec << " s, " << script.errors() << " bad lines\n";
+        file.printFileStats(std::cout);
+        collectStats().print(std::cout);
+        return script.errors() ? 1 : 0;
+    }
+
     std::string path = "data.txt";
     
     FileActions file1(path);
+    file1.enableChecksums();
     file1.registerActions({{"write", 100}, {"write", 200}});
     
     {
@@ -137,6 +2070,8 @@ int main() {
     }
     std::cout << "--- Copy Scope Ended ---\n";
     file1.executeActions();
+
+    FileActions::verifyChecksums(path);
     
     return 0;
 }
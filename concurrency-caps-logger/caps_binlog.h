@@ -0,0 +1,174 @@
+/* Binary Caps Lock log: a preallocated file mmap()ed as a ring of fixed-size
+ * records. Appending is a handful of stores into the mapping; the kernel
+ * writes the pages back, msync() only decides when that is forced.
+ * Shared by caps_loger.cpp (writer) and caps_log_decode.cpp (reader). */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char BINLOG_MAGIC[8] = {'C', 'A', 'P', 'S', 'B', 'L', 'O', 'G'};
+/* 2: BinaryLogRecord::lost. Version 1 records have the same layout with the
+ * field always 0, so they are still read, and appended to as version 2. */
+const uint32_t BINLOG_VERSION = 2;
+const uint32_t BINLOG_MIN_VERSION = 1;
+
+/* File header, one cache line at offset 0 */
+struct BinaryLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;  /* Records in the ring */
+    uint64_t nextSeq;   /* Sequence number of the next record, starts at 1 */
+    char reserved[32];
+};
+static_assert(sizeof(BinaryLogHeader) == 64, "header is one cache line");
+
+/* One transition, or with lost set a marker that this many events were
+ * dropped before reaching the log. seq is 0 while the slot is being
+ * rewritten, so a reader never mistakes a half-written record for a
+ * complete one. */
+struct BinaryLogRecord {
+    uint64_t seq;
+    int64_t wallNs;     /* Wall-clock time, ns since the epoch */
+    uint16_t source;    /* Monitor that reported it */
+    int8_t oldState;
+    int8_t newState;
+    uint32_t lost;      /* 0 for a transition; otherwise the number of events lost here */
+};
+static_assert(sizeof(BinaryLogRecord) == 24, "fixed record size");
+
+class BinaryLog {
+public:
+    BinaryLog() = default;
+    BinaryLog(const BinaryLog&) = delete;
+    BinaryLog& operator=(const BinaryLog&) = delete;
+    ~BinaryLog() { close(); }
+
+    /* Open for appending. A valid log with the same capacity continues at its
+     * next sequence number (an older version is marked current, see
+     * BINLOG_VERSION); anything else is recreated at full size. */
+    bool openForWrite(const char* path, uint64_t capacity) {
+        int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+            return false;
+        size_t size = sizeof(BinaryLogHeader) + capacity * sizeof(BinaryLogRecord);
+        struct stat st;
+        bool reuse = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size;
+        if (!reuse && (ftruncate(fd, 0) != 0 || posix_fallocate(fd, 0, size) != 0)) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            return false;
+        attach(map, size);
+
+        if (!reuse || !valid() || header_->capacity != capacity) {
+            std::memset(map, 0, size);
+            std::memcpy(header_->magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+            header_->version = BINLOG_VERSION;
+            header_->recordSize = sizeof(BinaryLogRecord);
+            header_->capacity = capacity;
+            header_->nextSeq = 1;
+        }
+        header_->version = BINLOG_VERSION;
+        return true;
+    }
+
+    bool openForRead(const char* path) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(BinaryLogHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+            return false;
+        attach(map, st.st_size);
+        if (!valid()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void append(int64_t wallNs, uint16_t source, int8_t oldState, int8_t newState, uint32_t lost = 0) {
+        uint64_t seq = header_->nextSeq;
+        BinaryLogRecord& rec = records_[(seq - 1) % header_->capacity];
+        __atomic_store_n(&rec.seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        rec.wallNs = wallNs;
+        rec.source = source;
+        rec.oldState = oldState;
+        rec.newState = newState;
+        rec.lost = lost;
+        __atomic_store_n(&rec.seq, seq, __ATOMIC_RELEASE);
+        __atomic_store_n(&header_->nextSeq, seq + 1, __ATOMIC_RELEASE);
+        dirtyFrom_ = std::min(dirtyFrom_, reinterpret_cast<char*>(&rec));
+        dirtyTo_ = std::max(dirtyTo_, reinterpret_cast<char*>(&rec + 1));
+    }
+
+    /* Push the records appended since the last call (and the header) towards
+     * disk: MS_SYNC waits for it, MS_ASYNC only schedules the writeback. */
+    void sync(bool wait) {
+        if (dirtyFrom_ >= dirtyTo_)
+            return;
+        int flags = wait ? MS_SYNC : MS_ASYNC;
+        uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        char* from = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(dirtyFrom_) & ~(page - 1));
+        msync(from, dirtyTo_ - from, flags);
+        msync(map_, sizeof(BinaryLogHeader), flags);
+        dirtyFrom_ = end();
+        dirtyTo_ = static_cast<char*>(map_);
+    }
+
+    uint64_t capacity() const { return header_->capacity; }
+    uint64_t nextSeq() const { return __atomic_load_n(&header_->nextSeq, __ATOMIC_ACQUIRE); }
+    const BinaryLogRecord& record(uint64_t slot) const { return records_[slot]; }
+
+    void close() {
+        if (map_) {
+            munmap(map_, size_);
+            map_ = nullptr;
+        }
+    }
+
+private:
+    void attach(void* map, size_t size) {
+        map_ = map;
+        size_ = size;
+        header_ = static_cast<BinaryLogHeader*>(map);
+        records_ = reinterpret_cast<BinaryLogRecord*>(static_cast<char*>(map) + sizeof(BinaryLogHeader));
+        dirtyFrom_ = end();
+        dirtyTo_ = static_cast<char*>(map);
+    }
+
+    bool valid() const {
+        return std::memcmp(header_->magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) == 0
+            && header_->version >= BINLOG_MIN_VERSION && header_->version <= BINLOG_VERSION
+            && header_->recordSize == sizeof(BinaryLogRecord)
+            && header_->capacity > 0
+            && sizeof(BinaryLogHeader) + header_->capacity * sizeof(BinaryLogRecord) <= size_;
+    }
+
+    char* end() const { return static_cast<char*>(map_) + size_; }
+
+    void* map_ = nullptr;
+    size_t size_ = 0;
+    BinaryLogHeader* header_ = nullptr;
+    BinaryLogRecord* records_ = nullptr;
+    char* dirtyFrom_ = nullptr;
+    char* dirtyTo_ = nullptr;
+};
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include <cstdio>
+
+#include "caps_binlog.h"
+
+/* Decoder for the caps logger's binary log (--log-format=binary).
+ * Prints the records still in the ring, oldest first, in the text log's
+ * "YYYY-MM-DD HH:MM:SS.nnnnnnnnn : [off]->[on]" format; --seconds drops the
+ * fraction, giving the original "YYYY-MM-DD HH:MM:SS : [off]->[on]".
+ * The file does not store LED names, so unlike the text log the lines do
+ * not end in one: --source prints the numeric source instead, the index
+ * the logger gave the LED in the order it started watching them, which
+ * can differ between runs appending to the same file. */
+int main(int argc, char* argv[]) {
+    std::string path = "caps_lock_log.bin";
+    bool seconds = false;
+    bool showSource = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seconds")
+            seconds = true;
+        else if (arg == "--source")
+            showSource = true;
+        else
+            path = arg;
+    }
+
+    BinaryLog log;
+    if (!log.openForRead(path.c_str())) {
+        std::cerr << "Not a readable binary caps log: " << path << std::endl;
+        return 1;
+    }
+
+    /* Slots hold the last `capacity` records in ring order; a slot whose seq
+     * is 0 was never written or was caught mid-rewrite. */
+    std::vector<BinaryLogRecord> records;
+    records.reserve(log.capacity());
+    uint64_t nextSeq = log.nextSeq();
+    for (uint64_t slot = 0; slot < log.capacity(); slot++) {
+        /* The logger may be appending right now: keep a copy only if its seq
+         * did not change while it was taken */
+        const BinaryLogRecord& live = log.record(slot);
+        uint64_t seq = __atomic_load_n(&live.seq, __ATOMIC_ACQUIRE);
+        BinaryLogRecord rec = live;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != 0 && seq < nextSeq && __atomic_load_n(&live.seq, __ATOMIC_RELAXED) == seq) {
+            rec.seq = seq;
+            records.push_back(rec);
+        }
+    }
+    std::sort(records.begin(), records.end(),
+              [](const BinaryLogRecord& a, const BinaryLogRecord& b) { return a.seq < b.seq; });
+
+    uint64_t expected = nextSeq > log.capacity() ? nextSeq - log.capacity() : 1;
+    uint64_t missing = 0;
+    for (const BinaryLogRecord& rec : records) {
+        missing += rec.seq - expected;
+        expected = rec.seq + 1;
+
+        std::time_t sec = static_cast<std::time_t>(rec.wallNs / 1000000000);
+        std::tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        char line[96];
+        size_t len = std::strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &tm_buf);
+        if (!seconds)
+            len += std::snprintf(line + len, sizeof(line) - len, ".%09lld",
+                                 static_cast<long long>(rec.wallNs % 1000000000));
+        if (rec.lost > 0)
+            std::snprintf(line + len, sizeof(line) - len, " : lost %u events", rec.lost);
+        else
+            std::snprintf(line + len, sizeof(line) - len, " : %s->%s",
+                          rec.oldState > 0 ? "[on]" : "[off]", rec.newState > 0 ? "[on]" : "[off]");
+        std::cout << line;
+        if (showSource)
+            std::cout << " (source " << rec.source << ", seq " << rec.seq << ")";
+        std::cout << '\n';
+    }
+    if (nextSeq - 1 > log.capacity())
+        std::cerr << "Ring wrapped: " << nextSeq - 1 - log.capacity() << " older records overwritten" << std::endl;
+    if (missing > 0)
+        std::cerr << missing << " records were being rewritten and are skipped" << std::endl;
+    return 0;
+}
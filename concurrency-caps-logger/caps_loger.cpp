@@ -6,105 +6,2411 @@
 #include <condition_variable>
 #include <queue>
 #include <chrono>
+#include <ctime>
 #include <atomic>
 #include <iomanip>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/magic.h>
+#include <linux/input.h>
+
+#include "caps_binlog.h"
+#include "caps_ring.h"
+#include "caps_pipeline.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-std::mutex logMutex;
-std::condition_variable logCv;
-std::queue<std::string> logQueue;
 std::atomic<bool> running(true);
 
-std::string getTimeStamp() {
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-    std::tm* now_tm = std::localtime(&now_c);
-    
-    std::stringstream ss;
-    ss << std::put_time(now_tm, "%Y-%m-%d %H:%M:%S");
-    return ss.str();
+/* Written on shutdown so threads blocked in poll() wake up immediately */
+int stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+/* Every return from the monitor's wait (event, timeout or sleep) */
+std::atomic<unsigned long> monitorWakeups(0);
+
+/* How monitorThread waits for the next change:
+ * Auto:        SysfsNotify on sysfs, Inotify elsewhere.
+ * SysfsNotify: poll(POLLPRI|POLLERR) on the attribute, with inotify beside
+ *              it for attributes that are changed by user-space writes.
+ * Inotify:     IN_MODIFY on the file only.
+ * Sleep:       the original 100 ms re-read loop, used as last resort. */
+enum class WaitMode { Auto, SysfsNotify, Inotify, Sleep };
+
+void requestStop() {
+    running = false;
+    uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0) { /* counter overflow only, already signalled */ }
+}
+
+inline int64_t clockNs(clockid_t id) {
+    timespec ts;
+    clock_gettime(id, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* Event timestamps: nanoseconds on a clock NTP never steps, read at detection.
+ * On x86 with a TSC the kernel itself trusts as clocksource, it is the TSC
+ * scaled by a rate calibrated once at startup (one rdtsc plus a multiply);
+ * otherwise CLOCK_MONOTONIC_RAW when the vDSO serves it cheaply, else
+ * CLOCK_MONOTONIC, which NTP only slews. Calibration error shows up as a
+ * drift between TSC time and wall time that the WallClockAnchor refresh
+ * absorbs every second. */
+struct EventClock {
+    enum Source { TSC, RAW, MONOTONIC } source = MONOTONIC;
+    int64_t baseTicks = 0;
+    int64_t baseNs = 0;
+    double nsPerTick = 1.0;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+bool kernelUsesTsc() {
+    std::ifstream cs("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+    std::string name;
+    return (cs >> name) && name == "tsc";
+}
+#endif
+
+EventClock calibrateEventClock() {
+    EventClock clock;
+#if defined(__x86_64__) || defined(__i386__)
+    if (kernelUsesTsc()) {
+        int64_t ns0 = clockNs(CLOCK_MONOTONIC_RAW);
+        int64_t ticks0 = static_cast<int64_t>(__rdtsc());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        int64_t ticks1 = static_cast<int64_t>(__rdtsc());
+        int64_t ns1 = clockNs(CLOCK_MONOTONIC_RAW);
+        if (ticks1 > ticks0) {
+            clock.source = EventClock::TSC;
+            clock.nsPerTick = static_cast<double>(ns1 - ns0) / static_cast<double>(ticks1 - ticks0);
+            clock.baseTicks = ticks1;
+            clock.baseNs = ns1;
+            return clock;
+        }
+    }
+#endif
+    const int calls = 1000;
+    auto start = std::chrono::steady_clock::now();
+    int64_t sink = 0;
+    for (int i = 0; i < calls; i++)
+        sink += clockNs(CLOCK_MONOTONIC_RAW);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+    clock.source = (sink != 0 && ns < 30.0) ? EventClock::RAW : EventClock::MONOTONIC;
+    return clock;
+}
+
+const EventClock eventClock = calibrateEventClock();
+
+inline int64_t captureEventTime() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (eventClock.source == EventClock::TSC)
+        return eventClock.baseNs + static_cast<int64_t>(
+            static_cast<double>(static_cast<int64_t>(__rdtsc()) - eventClock.baseTicks) * eventClock.nsPerTick);
+#endif
+    return clockNs(eventClock.source == EventClock::RAW ? CLOCK_MONOTONIC_RAW : CLOCK_MONOTONIC);
+}
+
+const char* eventClockName() {
+    switch (eventClock.source) {
+    case EventClock::TSC: return "TSC";
+    case EventClock::RAW: return "CLOCK_MONOTONIC_RAW";
+    default: return "CLOCK_MONOTONIC";
+    }
+}
+
+/* A timestamp taken on another clock (e.g. an evdev event) moved onto the event clock */
+int64_t toEventClock(clockid_t from, int64_t ns) {
+    return ns + (captureEventTime() - clockNs(from));
+}
+
+/* Turns event-clock times into wall-clock time for the log. The offset to
+ * CLOCK_REALTIME is re-measured every second, which follows NTP corrections
+ * and steps; if a step backwards would put a line before the previous one,
+ * the line is placed 1 ns after it instead, so the log stays strictly
+ * ordered. Used by the logger thread only. */
+class WallClockAnchor {
+public:
+    int64_t toWallNs(int64_t eventNs) {
+        int64_t now = captureEventTime();
+        if (now - anchoredAt_ >= 1000000000)
+            refresh();
+        int64_t wall = eventNs + offset_;
+        if (wall <= lastWall_)
+            wall = lastWall_ + 1;
+        lastWall_ = wall;
+        return wall;
+    }
+
+    void refresh() {
+        int64_t before = captureEventTime();
+        int64_t wall = clockNs(CLOCK_REALTIME);
+        int64_t after = captureEventTime();
+        offset_ = wall - (before + (after - before) / 2);
+        anchoredAt_ = after;
+    }
+
+private:
+    int64_t offset_ = 0;
+    int64_t anchoredAt_ = INT64_MIN / 2;
+    int64_t lastWall_ = INT64_MIN;
+};
+
+/* One detected transition. Fixed size, so it is copied into a ring slot
+ * and rendered to text by the logger rather than by the monitor. */
+struct LogEvent {
+    int64_t timeNs;   /* Event clock (see captureEventTime) at detection */
+    uint16_t source;  /* Which LED it came from, see sourceNames */
+    int8_t oldState;
+    int8_t newState;
+    uint32_t lost = 0; /* Non-zero: not a transition but a marker that this many were dropped here */
+};
+
+/* Hooks for ThreadHop (caps_pipeline.h): the marker a hop delivers after
+ * dropping events, made from the last event it delivered and stamped with
+ * that event's time so the log stays in time order, and how
+ * HopFull::Coalesce folds events of one LED together (first old state,
+ * last new state and time). */
+void markLost(LogEvent& marker, unsigned long lost) {
+    int64_t timeNs = marker.timeNs != 0 ? marker.timeNs : captureEventTime();
+    marker = LogEvent{timeNs, 0, -1, -1, static_cast<uint32_t>(lost)};
 }
 
+unsigned long lostCount(const LogEvent& ev) { return ev.lost; }
+
+uint16_t coalesceKey(const LogEvent& ev) { return ev.source; }
+
+void coalesce(LogEvent& pending, const LogEvent& newer) {
+    pending.timeNs = newer.timeNs;
+    pending.newState = newer.newState;
+}
+
+/* When the logger forces appended batches to stable storage:
+ * None:     leave it to the page cache (default; same as the old ofstream).
+ * Batch:    fdatasync() after every batch.
+ * Interval: fdatasync() at most every logSyncIntervalMs, and on shutdown. */
+enum class Durability { None, Batch, Interval };
+Durability logDurability = Durability::None;
+const long logSyncIntervalMs = 1000;
+const size_t logBatchBytes = 64 * 1024;
+
+/* Text: caps_lock_log.txt, one formatted line per event.
+ * Binary: caps_lock_log.bin, a ring of binaryLogCapacity fixed-size records
+ * (see caps_binlog.h), rendered to text offline by caps_log_decode. */
+enum class LogFormat { Text, Binary };
+LogFormat logFormat = LogFormat::Text;
+const uint64_t binaryLogCapacity = 1 << 16;
+
+/* What the monitor -> logger queue, and the log file's fan-out ring behind
+ * it, do once full (logQueueCapacity events): block the monitor, drop the
+ * newest or oldest event, or coalesce to the latest state per LED. Whatever
+ * is lost is counted and noted in the log as a "lost N events" line (a
+ * marker record in binary format). */
+const size_t logQueueCapacity = 4096;
+HopFull logQueuePolicy = HopFull::DropNewest;
+
+const char* hopFullName(HopFull full) {
+    switch (full) {
+    case HopFull::Block: return "block";
+    case HopFull::DropNewest: return "drop-newest";
+    case HopFull::DropOldest: return "drop-oldest";
+    case HopFull::Coalesce: return "coalesce";
+    }
+    return "?";
+}
+
+/* Echo every logged line to stdout ("Logged: ...") */
+bool logToConsole = true;
+
+/* Unix socket that subscribers connect to for a live copy of the log
+ * lines (e.g. `socat - UNIX-CONNECT:caps_lock_log.sock`); empty disables it.
+ * A subscriber more than subscriberBacklogBytes behind loses lines. */
+std::string subscriberSocketPath;
+const size_t subscriberBacklogBytes = 64 * 1024;
+
+/* Text log rotation: once the current segment would grow past
+ * rotateMaxBytes, or the first batch after it turned rotateIntervalSec old,
+ * it is renamed to caps_lock_log-YYYYMMDD-HHMMSS[-n].txt and gzipped in the
+ * background. 0 disables either trigger. */
+size_t rotateMaxBytes = 0;
+long rotateIntervalSec = 0;
+
+/* Filled in by LogWriterSink */
+unsigned long rotations = 0;
+int64_t worstRotationPauseNs = 0;
+
+/* Names of the LEDs being watched, indexed by LogEvent::source. Filled
+ * before the monitor threads start; with more than one entry the logger
+ * appends the name to each line. */
+std::vector<std::string> sourceNames;
+
+uint16_t registerSource(const std::string& name) {
+    sourceNames.push_back(name.substr(0, 64));
+    return static_cast<uint16_t>(sourceNames.size() - 1);
+}
+
+/* Monitor threads that do not run inside a pipeline (the benchmarks start
+ * them directly) -> whoever reads it. MPSC so any number can share it. */
+MpscRing<LogEvent> logRing;
+std::atomic<unsigned long> droppedEvents(0);
+
+/* Set by MonitorSource on the thread it runs a monitor on: reportChange()
+ * then emits into the pipeline instead of logRing */
+struct EventEmitter {
+    void* context;
+    void (*emit)(void* context, const LogEvent& ev);
+};
+thread_local EventEmitter threadEmitter{nullptr, nullptr};
+
+/* Renders wall-clock time as "YYYY-MM-DD HH:MM:SS[.nnnnnnnnn]" into a caller
+ * buffer without allocating. The text of the current minute is cached, so
+ * localtime_r() only runs when a timestamp leaves that minute (timezone and
+ * DST changes land on minute boundaries); within it, only the seconds digits
+ * are patched when the second changes. Zones whose UTC offset is not whole
+ * minutes fall back to a per-second cache. Not shared between threads. */
+class TimestampFormatter {
+public:
+    static const size_t MAX_LEN = 29;
+
+    size_t format(std::time_t sec, long nsec, char* out) {
+        if (sec < windowStart_ || sec >= windowEnd_)
+            refresh(sec);
+        if (sec != cachedSec_) {
+            int s = static_cast<int>(sec - minuteStart_);
+            text_[17] = static_cast<char>('0' + s / 10);
+            text_[18] = static_cast<char>('0' + s % 10);
+            cachedSec_ = sec;
+        }
+        std::memcpy(out, text_, 19);
+        if (nsec < 0)
+            return 19;
+        out[19] = '.';
+        for (int i = 28; i > 19; i--) {
+            out[i] = static_cast<char>('0' + nsec % 10);
+            nsec /= 10;
+        }
+        return 29;
+    }
+
+private:
+    void refresh(std::time_t sec) {
+        std::tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        std::strftime(text_, sizeof(text_), "%Y-%m-%d %H:%M:%S", &tm_buf);
+        cachedSec_ = sec;
+        minuteStart_ = sec - tm_buf.tm_sec;
+        if (tm_buf.tm_gmtoff % 60 == 0) {
+            windowStart_ = minuteStart_;
+            windowEnd_ = minuteStart_ + 60;
+        } else {
+            windowStart_ = sec;
+            windowEnd_ = sec + 1;
+        }
+    }
+
+    char text_[32] = {};
+    std::time_t cachedSec_ = 0;
+    std::time_t minuteStart_ = 0;
+    std::time_t windowStart_ = 0;
+    std::time_t windowEnd_ = 0;
+};
+
+const size_t EVENT_TEXT_MAX = TimestampFormatter::MAX_LEN + 16 + 65;
+
+/* "<wall time> : [off]->[on]" into out (EVENT_TEXT_MAX bytes), returns the
+ * length. " <source name>" follows when several LEDs are watched. A lost
+ * marker reads "<wall time> : lost N events". */
+size_t formatEvent(const LogEvent& ev, int64_t wallNs, char* out) {
+    static thread_local TimestampFormatter formatter;
+    size_t len = formatter.format(static_cast<std::time_t>(wallNs / 1000000000),
+                                  static_cast<long>(wallNs % 1000000000), out);
+    auto append = [&](const char* text) {
+        size_t n = std::strlen(text);
+        std::memcpy(out + len, text, n);
+        len += n;
+    };
+    append(" : ");
+    if (ev.lost > 0) {
+        len += std::snprintf(out + len, EVENT_TEXT_MAX - len, "lost %u events", ev.lost);
+        return len;
+    }
+    append(ev.oldState > 0 ? "[on]" : "[off]");
+    append("->");
+    append(ev.newState > 0 ? "[on]" : "[off]");
+    if (sourceNames.size() > 1 && ev.source < sourceNames.size()) {
+        append(" ");
+        append(sourceNames[ev.source].c_str());
+    }
+    return len;
+}
+
+/* -1 if the attribute cannot be opened or read (e.g. the device is gone) */
 int getCapsLockState(const std::string& path) {
     std::ifstream file(path);
     int value = 0;
-    if (file) {
-        file >> value;
-    }
+    if (!file || !(file >> value))
+        return -1;
+    return value;
+}
+
+/* Re-read an open attribute from the start; on sysfs this also re-arms POLLPRI.
+ * One pread() per sample and a plain digit loop, no stream or locale.
+ * -1 if the read fails, e.g. ENODEV once the keyboard is unplugged. */
+int readStateFd(int fd) {
+    char buf[16];
+    ssize_t n = pread(fd, buf, sizeof(buf), 0);
+    if (n < 0)
+        return -1;
+    int value = 0;
+    ssize_t i = 0;
+    while (i < n && (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n'))
+        i++;
+    for (; i < n && buf[i] >= '0' && buf[i] <= '9'; i++)
+        value = value * 10 + (buf[i] - '0');
     return value;
 }
 
-/* Thread 1: Monitor Caps Lock state */
-void monitorThread(std::string path) {
-    int lastState = getCapsLockState(path);
+/* Hand a change to the logger. If the logger has fallen a whole queue
+ * behind, logQueuePolicy decides (only Block makes the monitor wait); the
+ * benchmarks' logRing always counts the event as dropped. */
+void reportChange(int lastState, int currentState, int64_t timeNs, uint16_t source = 0) {
+    LogEvent ev{timeNs, source, static_cast<int8_t>(lastState), static_cast<int8_t>(currentState)};
+    if (threadEmitter.emit)
+        threadEmitter.emit(threadEmitter.context, ev);
+    else if (!logRing.tryPush(ev))
+        droppedEvents.fetch_add(1, std::memory_order_relaxed);
+}
+
+void reportChange(int lastState, int currentState) {
+    reportChange(lastState, currentState, captureEventTime());
+}
+
+/* Last resort: re-read the file every 100 ms. The attribute stays open for
+ * the whole loop; only if it cannot be opened, or stops being readable, is
+ * it looked up by path on every sample. Samples that fail are skipped, so a
+ * device that goes away costs one failed open per 100 ms and is picked up
+ * again when it returns. lastState is the state already known, if any. */
+void sleepMonitorLoop(const std::string& path, int lastState = -1) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    auto sample = [&]() {
+        if (fd != -1) {
+            int value = readStateFd(fd);
+            if (value >= 0)
+                return value;
+            close(fd);
+            fd = -1;
+        }
+        return getCapsLockState(path);
+    };
+    if (lastState < 0)
+        lastState = sample();
     
     while (running) {
-        int currentState = getCapsLockState(path);
+        int currentState = sample();
         
-        if (currentState != lastState) {
-            std::string stateStr = (lastState > 0 ? "[on]" : "[off]");
-            stateStr += "->";
-            stateStr += (currentState > 0 ? "[on]" : "[off]");
-            
-            std::string timestamp = getTimeStamp();
-            std::string logMsg = timestamp + " : " + stateStr;
-
-            {
-                std::lock_guard<std::mutex> lock(logMutex);
-                logQueue.push(logMsg);
-            }
-            logCv.notify_one();
-            
+        if (currentState >= 0 && currentState != lastState) {
+            if (lastState >= 0)
+                reportChange(lastState, currentState);
             lastState = currentState;
         }
         
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        monitorWakeups++;
     }
+    if (fd != -1)
+        close(fd);
 }
 
-/* Thread 2: Write logs to file */
-void loggerThread() {
-    std::ofstream logFile("caps_lock_log.txt", std::ios::app);
-    if (!logFile.is_open()) {
-        std::cerr << "Failed to open log file!" << std::endl;
+/* Thread 1: Monitor Caps Lock state
+ * Blocks until the attribute signals a change instead of waking every 100 ms.
+ * Not every sysfs attribute calls sysfs_notify(), so the monitor starts with
+ * a 100 ms watchdog re-read. Once a notification has delivered a change, the
+ * watchdog is dropped and the thread sleeps until the next event. If the
+ * watchdog catches a change no notification announced, the attribute does
+ * not notify and the 100 ms re-read simply stays on. Only the notification
+ * the mode relies on earns that credit: on sysfs inotify fires just for
+ * writes from user space, never for keyboard-driven changes, so there it
+ * only wakes the thread early. If the attribute stops being readable (the
+ * keyboard was unplugged), the monitor falls back to sleepMonitorLoop. */
+void monitorThread(std::string path, WaitMode mode = WaitMode::Auto) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        mode = WaitMode::Sleep;
+
+    if (mode == WaitMode::Auto) {
+        struct statfs fs;
+        bool sysfs = fstatfs(fd, &fs) == 0 && fs.f_type == SYSFS_MAGIC;
+        mode = sysfs ? WaitMode::SysfsNotify : WaitMode::Inotify;
+    }
+
+    int inotifyFd = -1;
+    if (mode != WaitMode::Sleep) {
+        inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (inotifyFd != -1 && inotify_add_watch(inotifyFd, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE) == -1) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+        if (mode == WaitMode::Inotify && inotifyFd == -1)
+            mode = WaitMode::Sleep;
+    }
+
+    if (mode == WaitMode::Sleep) {
+        std::cout << "Wait mode: 100 ms polling" << std::endl;
+        if (fd != -1)
+            close(fd);
+        sleepMonitorLoop(path);
         return;
     }
+    std::cout << "Wait mode: " << (mode == WaitMode::SysfsNotify ? "sysfs POLLPRI + inotify" : "inotify") << std::endl;
 
-    while (running || !logQueue.empty()) {
-        std::unique_lock<std::mutex> lock(logMutex);
-        logCv.wait(lock, []{ return !logQueue.empty() || !running; });
+    int lastState = readStateFd(fd);
+    int watchdogMs = 100;
+    bool failed = lastState < 0;
+    int error = errno;
 
-        while (!logQueue.empty()) {
-            std::string msg = logQueue.front();
-            logQueue.pop();
-            lock.unlock();
-            
-            logFile << msg << std::endl;
-            std::cout << "Logged: " << msg << std::endl;
+    while (running && !failed) {
+        pollfd fds[3] = {
+            {stopFd, POLLIN, 0},
+            {fd, static_cast<short>(mode == WaitMode::SysfsNotify ? (POLLPRI | POLLERR) : 0), 0},
+            {inotifyFd, POLLIN, 0},
+        };
+        int ready = poll(fds, inotifyFd == -1 ? 2 : 3, watchdogMs);
+        monitorWakeups++;
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (ready > 0 && fds[0].revents)
+            break;
+
+        bool notified = ready > 0 && (mode == WaitMode::SysfsNotify ? fds[1].revents != 0
+                                                                    : inotifyFd != -1 && fds[2].revents != 0);
+        if (inotifyFd != -1 && fds[2].revents) {
+            char events[4096];
+            while (read(inotifyFd, events, sizeof(events)) > 0) {}
+        }
+
+        int currentState = readStateFd(fd);
+        if (currentState < 0) {
+            error = errno;
+            failed = true;
+            break;
+        }
+        if (currentState != lastState) {
+            if (notified)
+                watchdogMs = -1; /* The attribute notifies: wait for events only */
+            reportChange(lastState, currentState);
+            lastState = currentState;
+        }
+    }
+
+    if (inotifyFd != -1)
+        close(inotifyFd);
+    close(fd);
+    if (failed && running) {
+        std::cerr << "Cannot read " << path << ": " << std::strerror(error)
+                  << ", falling back to 100 ms polling" << std::endl;
+        sleepMonitorLoop(path, lastState);
+    }
+}
+
+/* Gzips closed log segments on its own thread, at nice 19 and idle I/O
+ * priority (both inherited by the gzip child), so compression only uses
+ * what the logger and monitors leave over. */
+class SegmentCompressor {
+public:
+    ~SegmentCompressor() { finish(); }
+
+    /* Spawned up front so thread creation is not part of a rotation pause */
+    void start() {
+        thread_ = std::thread(&SegmentCompressor::run, this);
+    }
+
+    void submit(const std::string& path) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push(path);
+        }
+        cv_.notify_one();
+    }
 
+    /* Compress whatever is still queued, then stop the thread */
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+private:
+    void run() {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+        const int IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13, IOPRIO_WHO_PROCESS = 1;
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]{ return !pending_.empty() || stopping_; });
+            if (pending_.empty())
+                break;
+            std::string path = pending_.front();
+            pending_.pop();
+            lock.unlock();
+            compress(path);
             lock.lock();
         }
     }
-    logFile.close();
+
+    static void compress(const std::string& path) {
+        char* argv[] = {const_cast<char*>("gzip"), const_cast<char*>("-f"),
+                        const_cast<char*>("--"), const_cast<char*>(path.c_str()), nullptr};
+        pid_t pid;
+        int status = 0;
+        if (posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) != 0
+            || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            std::cerr << "Could not compress " << path << ", left as is" << std::endl;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::queue<std::string> pending_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+/* Name for a closed segment; a counter keeps two rotations in one second apart */
+std::string segmentName() {
+    std::time_t now = std::time(nullptr);
+    std::tm tm_buf;
+    localtime_r(&now, &tm_buf);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_buf);
+    std::string name = std::string("caps_lock_log-") + stamp + ".txt";
+    for (int n = 1; access(name.c_str(), F_OK) == 0 || access((name + ".gz").c_str(), F_OK) == 0; n++)
+        name = std::string("caps_lock_log-") + stamp + "-" + std::to_string(n) + ".txt";
+    return name;
+}
+
+/* Write the whole buffer, resuming after short writes and EINTR */
+bool writeFully(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* An event with its wall-clock time attached */
+struct TimedEvent {
+    LogEvent event;
+    int64_t wallNs;
+};
+
+/* Pipeline stage: event clock -> wall clock (see WallClockAnchor) */
+class WallClockStage {
+public:
+    template <typename Next>
+    void operator()(const LogEvent& ev, Next& next) {
+        next(TimedEvent{ev, anchor_.toWallNs(ev.timeNs)});
+    }
+
+private:
+    WallClockAnchor anchor_;
+};
+
+/* An event with its wall-clock time and rendered text line ("...\n") */
+struct LogLine {
+    LogEvent event;
+    int64_t wallNs;
+    uint16_t length;
+    char text[EVENT_TEXT_MAX + 1];
+};
+
+/* Pipeline stage: render the line once, ahead of the sinks that share it */
+struct FormatStage {
+    template <typename Next>
+    void operator()(const TimedEvent& te, Next& next) {
+        LogLine line;
+        line.event = te.event;
+        line.wallNs = te.wallNs;
+        size_t len = formatEvent(te.event, te.wallNs, line.text);
+        line.text[len++] = '\n';
+        line.length = static_cast<uint16_t>(len);
+        next(line);
+    }
+};
+
+/* Lost marker for a fan-out sink that had to drop lines, at the time of
+ * the last line it got */
+void markLost(LogLine& marker, unsigned long lost) {
+    markLost(marker.event, lost);
+    if (marker.wallNs == 0)
+        marker.wallNs = clockNs(CLOCK_REALTIME);
+    size_t len = formatEvent(marker.event, marker.wallNs, marker.text);
+    marker.text[len++] = '\n';
+    marker.length = static_cast<uint16_t>(len);
+}
+
+/* A fan-out lane that drops a "lost N events" line reports the N in its
+ * own marker; HopFull::Coalesce on a lane keeps one line per LED,
+ * re-rendered with the latest state and time */
+unsigned long lostCount(const LogLine& line) { return lostCount(line.event); }
+
+uint16_t coalesceKey(const LogLine& line) { return coalesceKey(line.event); }
+
+void coalesce(LogLine& pending, const LogLine& newer) {
+    coalesce(pending.event, newer.event);
+    pending.wallNs = newer.wallNs;
+    size_t len = formatEvent(pending.event, pending.wallNs, pending.text);
+    pending.text[len++] = '\n';
+    pending.length = static_cast<uint16_t>(len);
 }
 
-int main() {
+/* Thread 2: Write logs to file (pipeline sink)
+ * Lines are collected into one buffer as they arrive; flush(), which the
+ * pipeline calls once it has drained everything queued (or when the
+ * buffer reaches logBatchBytes), appends the batch with a single write()
+ * on an O_APPEND fd. Whether the batch is also forced to disk is up to logDurability. In
+ * binary format each event is stored straight into the mapped ring
+ * instead, and the mapping is msync()ed where the text file would be
+ * fdatasync()ed, plus an asynchronous msync once per logSyncIntervalMs.
+ * Rotation happens in flush() too, between two batch writes: the segment
+ * is renamed while its fd stays open, a fresh caps_lock_log.txt is opened
+ * and the old fd closed, so every line lands in exactly one segment. Only
+ * the rename and open are on the logging path; compression is not. */
+class LogWriterSink {
+public:
+    bool open() {
+        binary_ = logFormat == LogFormat::Binary;
+        if (binary_ ? !binLog_->openForWrite("caps_lock_log.bin", binaryLogCapacity)
+                    : (logFd_ = ::open("caps_lock_log.txt", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+            std::cerr << "Failed to open log file!" << std::endl;
+            return false;
+        }
+        batch_.reserve(logBatchBytes + 256);
+        struct stat st;
+        segmentBytes_ = (!binary_ && fstat(logFd_, &st) == 0) ? st.st_size : 0;
+        segmentStart_ = lastSync_ = std::chrono::steady_clock::now();
+        if (!binary_ && (rotateMaxBytes > 0 || rotateIntervalSec > 0))
+            compressor_->start();
+        return true;
+    }
+
+    const char* name() const { return "file"; }
+
+    /* A stalled disk fills this sink's fan-out ring first */
+    HopFull queuePolicy() const { return logQueuePolicy; }
+
+    void operator()(const LogLine& line) {
+        const LogEvent& ev = line.event;
+        if (binary_)
+            binLog_->append(line.wallNs, ev.source, ev.oldState, ev.newState, ev.lost);
+        else
+            batch_.append(line.text, line.length);
+        appended_ = true;
+        if (batch_.size() >= logBatchBytes)
+            flush();
+    }
+
+    void flush() {
+        if (!batch_.empty() && rotateDue())
+            rotate();
+
+        if (!batch_.empty()) {
+            if (writeFully(logFd_, batch_.data(), batch_.size()))
+                segmentBytes_ += batch_.size();
+            else
+                std::cerr << "Log write failed: " << std::strerror(errno) << std::endl;
+        }
+        unsynced_ = unsynced_ || appended_;
+        appended_ = false;
+        batch_.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        if (unsynced_ && (logDurability == Durability::Batch
+                          || (periodic() && now - lastSync_ >= std::chrono::milliseconds(logSyncIntervalMs))))
+            sync(now);
+    }
+
+    /* Wake the logger for the next periodic sync */
+    int waitTimeoutMs() const {
+        if (!unsynced_ || !periodic())
+            return -1;
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastSync_).count();
+        return static_cast<int>(std::max<long>(0, logSyncIntervalMs - elapsed));
+    }
+
+    void close() {
+        flush();
+        if (unsynced_ && logDurability != Durability::None)
+            sync(std::chrono::steady_clock::now());
+        else if (unsynced_ && binary_)
+            binLog_->sync(false);
+        if (logFd_ != -1)
+            ::close(logFd_);
+        logFd_ = -1;
+        binLog_->close();
+        compressor_->finish();
+        if (rotations > 0)
+            std::cout << "Rotated " << rotations << " log segments, worst logging pause during rotation "
+                      << worstRotationPauseNs / 1000.0 << " us" << std::endl;
+    }
+
+private:
+    bool periodic() const { return logDurability == Durability::Interval || binary_; }
+
+    void sync(std::chrono::steady_clock::time_point now) {
+        if (binary_)
+            binLog_->sync(logDurability != Durability::None);
+        else
+            fdatasync(logFd_);
+        unsynced_ = false;
+        lastSync_ = now;
+    }
+
+    bool rotateDue() const {
+        return segmentBytes_ > 0
+            && ((rotateMaxBytes > 0 && segmentBytes_ + batch_.size() > rotateMaxBytes)
+                || (rotateIntervalSec > 0 && std::chrono::steady_clock::now() - segmentStart_ >= std::chrono::seconds(rotateIntervalSec)));
+    }
+
+    void rotate() {
+        auto pauseStart = std::chrono::steady_clock::now();
+        std::string closed = segmentName();
+        int nextFd = -1;
+        if (rename("caps_lock_log.txt", closed.c_str()) == 0) {
+            nextFd = ::open("caps_lock_log.txt", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (nextFd == -1)
+                rename(closed.c_str(), "caps_lock_log.txt"); /* Keep logging into the old segment */
+        }
+        if (nextFd != -1) {
+            if (unsynced_ && logDurability != Durability::None)
+                fdatasync(logFd_);
+            ::close(logFd_);
+            logFd_ = nextFd;
+            segmentBytes_ = 0;
+            segmentStart_ = std::chrono::steady_clock::now();
+            compressor_->submit(closed);
+            rotations++;
+        } else {
+            std::cerr << "Log rotation failed: " << std::strerror(errno) << std::endl;
+            segmentStart_ = std::chrono::steady_clock::now(); /* Retry on the next trigger */
+        }
+        worstRotationPauseNs = std::max<int64_t>(worstRotationPauseNs,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pauseStart).count());
+    }
+
+    bool binary_ = false;
+    int logFd_ = -1;
+    std::unique_ptr<BinaryLog> binLog_ = std::make_unique<BinaryLog>();
+    std::unique_ptr<SegmentCompressor> compressor_ = std::make_unique<SegmentCompressor>();
+    std::string batch_;
+    bool appended_ = false;
+    bool unsynced_ = false;
+    std::chrono::steady_clock::time_point lastSync_;
+    size_t segmentBytes_ = 0;
+    std::chrono::steady_clock::time_point segmentStart_;
+};
+
+/* Thread 3: console echo (fan-out sink), "Logged: <line>", one write per
+ * batch. On its own thread, so a slow or paused terminal backs up only this
+ * sink's queue, never the log file. */
+class ConsoleSink {
+public:
+    bool enabled() const { return logToConsole; }
+    const char* name() const { return "console"; }
+
+    void operator()(const LogLine& line) {
+        echo_ += "Logged: ";
+        echo_.append(line.text, line.length);
+        if (echo_.size() >= logBatchBytes)
+            flush();
+    }
+
+    void flush() {
+        if (echo_.empty())
+            return;
+        std::cout << echo_ << std::flush;
+        echo_.clear();
+    }
+
+private:
+    std::string echo_;
+};
+
+/* Thread 4: Unix-socket subscribers (fan-out sink). Every client connected
+ * to subscriberSocketPath gets each batch of log lines. Sends never block:
+ * what a client cannot take yet waits in its backlog, and once that would
+ * pass subscriberBacklogBytes the client misses whole batches until it
+ * catches up; those lines are reported as this sink's drops (once per
+ * subscriber that missed them). New clients are accepted at each flush. */
+class SubscriberSink {
+public:
+    bool open(const std::string& path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Subscriber socket path too long: " << path << std::endl;
+            return false;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        unlink(path.c_str());
+        listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd_ == -1 || bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(listenFd_, 16) != 0) {
+            std::cerr << "Failed to open subscriber socket " << path << ": " << std::strerror(errno) << std::endl;
+            if (listenFd_ != -1)
+                ::close(listenFd_);
+            listenFd_ = -1;
+            return false;
+        }
+        path_ = path;
+        return true;
+    }
+
+    bool enabled() const { return listenFd_ != -1; }
+    const char* name() const { return "subscribers"; }
+
+    void operator()(const LogLine& line) {
+        batch_.append(line.text, line.length);
+        batchLines_++;
+    }
+
+    void flush() {
+        acceptClients();
+        for (Client& client : clients_) {
+            if (!batch_.empty()) {
+                if (client.backlog.size() + batch_.size() > subscriberBacklogBytes)
+                    linesLost_->fetch_add(batchLines_, std::memory_order_relaxed);
+                else
+                    client.backlog += batch_;
+            }
+            sendBacklog(client);
+        }
+        clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+                                      [](const Client& client) { return client.fd == -1; }),
+                       clients_.end());
+        batch_.clear();
+        batchLines_ = 0;
+    }
+
+    /* Come back for clients that still have a backlog */
+    int waitTimeoutMs() const {
+        for (const Client& client : clients_)
+            if (!client.backlog.empty())
+                return 50;
+        return -1;
+    }
+
+    void close() {
+        for (Client& client : clients_)
+            ::close(client.fd);
+        clients_.clear();
+        if (listenFd_ != -1) {
+            ::close(listenFd_);
+            unlink(path_.c_str());
+        }
+        listenFd_ = -1;
+        if (accepted_ > 0)
+            std::cout << "Served " << accepted_ << " subscribers, " << dropped()
+                      << " lines dropped for subscribers that fell behind" << std::endl;
+    }
+
+    /* Lines dropped, summed over clients: a line three clients missed counts three times */
+    unsigned long dropped() const { return linesLost_->load(std::memory_order_relaxed); }
+
+private:
+    struct Client {
+        int fd;
+        std::string backlog;
+    };
+
+    void acceptClients() {
+        int fd;
+        while ((fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+            clients_.push_back({fd, std::string()});
+            accepted_++;
+        }
+    }
+
+    /* Send what the socket takes; a client that hung up or failed is closed */
+    void sendBacklog(Client& client) {
+        size_t sent = 0;
+        while (sent < client.backlog.size()) {
+            ssize_t n = send(client.fd, client.backlog.data() + sent, client.backlog.size() - sent,
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            ::close(client.fd);
+            client.fd = -1;
+            break;
+        }
+        client.backlog.erase(0, sent);
+    }
+
+    int listenFd_ = -1;
+    std::string path_;
+    std::vector<Client> clients_;
+    std::string batch_;
+    unsigned long batchLines_ = 0;
+    unsigned long accepted_ = 0;
+    std::unique_ptr<std::atomic<unsigned long>> linesLost_ = std::make_unique<std::atomic<unsigned long>>(0);
+};
+
+/* Per-sink delivery report of a fan-out */
+void printSinkStats(const std::vector<SinkStats>& stats) {
+    for (const SinkStats& sink : stats) {
+        if (!sink.enabled)
+            continue;
+        std::cout << "  sink " << sink.name << ": " << sink.delivered << " delivered, " << sink.dropped
+                  << " dropped, " << sink.pending << " pending, lag " << sink.lastLagNs / 1000.0
+                  << " us last / " << sink.maxLagNs / 1000.0 << " us max";
+        if (sink.sinkDropped > 0)
+            std::cout << ", " << sink.sinkDropped << " dropped by the sink itself";
+        std::cout << std::endl;
+    }
+}
+
+/* Open a source of input_event records for reading. A FIFO is opened
+ * O_NONBLOCK, since a blocking open() waits for a writer where
+ * requestStop() cannot reach it, and the flag is cleared again unless
+ * nonBlocking asks to keep it. A Unix socket cannot be open()ed at all and
+ * is connect()ed instead. */
+int openEventSource(const std::string& path, bool nonBlocking) {
+    int fd;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd != -1 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        if (fd != -1 && nonBlocking)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return fd;
+    }
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd != -1 && !nonBlocking)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
+
+/* Thread 1 (evdev source): Caps Lock LED events from an input device.
+ * Reads struct input_event records of type EV_LED / LED_CAPSL, so every
+ * transition is seen exactly once and stamped with the kernel's event time
+ * (moved onto the event clock) instead of the moment we got around to
+ * looking. Any file that carries input_event records works, e.g. a FIFO or
+ * Unix socket fed by a test; its record times are taken as CLOCK_REALTIME. */
+void evdevMonitorThread(std::string devicePath) {
+    int fd = openEventSource(devicePath, false);
+    if (fd == -1) {
+        std::cerr << "Failed to open input device " << devicePath << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    /* Real evdev nodes: monotonic event times and the current LED state.
+     * Both ioctls fail harmlessly on a pipe. */
+    int clockId = CLOCK_MONOTONIC;
+    if (ioctl(fd, EVIOCSCLOCKID, &clockId) < 0)
+        clockId = CLOCK_REALTIME;
+    auto queryLed = [fd]() {
+        unsigned char leds[(LED_MAX + 8) / 8] = {};
+        if (ioctl(fd, EVIOCGLED(sizeof(leds)), leds) < 0)
+            return -1;
+        return (leds[LED_CAPSL / 8] >> (LED_CAPSL % 8)) & 1;
+    };
+    int lastState = queryLed();
+
+    std::cout << "Event source: " << devicePath << std::endl;
+
+    input_event events[64];
+    size_t buffered = 0; /* Bytes of a partial record left over from a pipe read */
+    while (running) {
+        pollfd fds[2] = {{stopFd, POLLIN, 0}, {fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        monitorWakeups++;
+        if (fds[0].revents)
+            break;
+
+        ssize_t n = read(fd, reinterpret_cast<char*>(events) + buffered, sizeof(events) - buffered);
+        if (n <= 0) {
+            if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            break; /* Device gone or writer closed the pipe */
+        }
+        buffered += n;
+        int64_t kernelToEvent = toEventClock(clockId, 0); /* One clock pair per read, not per record */
+
+        size_t count = buffered / sizeof(input_event);
+        for (size_t i = 0; i < count; i++) {
+            const input_event& ev = events[i];
+            if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+                /* Kernel buffer overflowed: resynchronise from the device */
+                int state = queryLed();
+                if (state >= 0 && lastState >= 0 && state != lastState)
+                    reportChange(lastState, state);
+                lastState = state;
+                continue;
+            }
+            if (ev.type != EV_LED || ev.code != LED_CAPSL)
+                continue;
+
+            int state = ev.value ? 1 : 0;
+            if (lastState == -1)
+                lastState = !state; /* Unknown start state: the event itself is the transition */
+            if (state != lastState) {
+                reportChange(lastState, state, static_cast<int64_t>(ev.input_event_sec) * 1000000000
+                                              + static_cast<int64_t>(ev.input_event_usec) * 1000 + kernelToEvent);
+                lastState = state;
+            }
+        }
+
+        size_t consumed = count * sizeof(input_event);
+        buffered -= consumed;
+        std::memmove(events, reinterpret_cast<char*>(events) + consumed, buffered);
+    }
+    close(fd);
+}
+
+/* An LED for the epoll monitor: a brightness-style attribute (sysfs or any
+ * file holding a number) or an input device carrying EV_LED events */
+struct LedSource {
+    enum Kind { Attribute, InputDevice } kind;
+    std::string path;
+};
+
+const char* ledName(int code) {
+    switch (code) {
+    case LED_NUML: return "numlock";
+    case LED_CAPSL: return "capslock";
+    case LED_SCROLLL: return "scrolllock";
+    case LED_COMPOSE: return "compose";
+    case LED_KANA: return "kana";
+    default: return nullptr;
+    }
+}
+
+/* Every LED class device and every input device that has LEDs */
+std::vector<LedSource> discoverLedSources() {
+    std::vector<LedSource> sources;
+    auto scan = [](const char* dirPath, auto&& fn) {
+        DIR* dir = opendir(dirPath);
+        if (!dir)
+            return;
+        std::vector<std::string> names;
+        while (dirent* entry = readdir(dir))
+            if (entry->d_name[0] != '.')
+                names.push_back(entry->d_name);
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        for (const std::string& name : names)
+            fn(std::string(dirPath) + "/" + name, name);
+    };
+    scan("/sys/class/leds", [&](const std::string& path, const std::string&) {
+        sources.push_back({LedSource::Attribute, path + "/brightness"});
+    });
+    scan("/dev/input", [&](const std::string& path, const std::string& name) {
+        if (name.rfind("event", 0) != 0)
+            return;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if (fd == -1)
+            return;
+        unsigned long types = 0;
+        if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), &types) >= 0 && (types & (1UL << EV_LED)))
+            sources.push_back({LedSource::InputDevice, path});
+        close(fd);
+    });
+    return sources;
+}
+
+/* Thread 1 (many sources): every LED on one thread.
+ * All sources share one epoll set: sysfs attributes wait for POLLPRI,
+ * attributes changed from user space are covered by one shared inotify fd,
+ * input devices deliver EV_LED records (one source id per LED code on the
+ * device). Attributes start on a shared 100 ms watchdog timer, as in
+ * monitorThread, and leave it once a notification has delivered a change;
+ * the timer is disarmed when no attribute needs it. On sysfs only POLLPRI
+ * counts as such a notification (inotify sees writes from user space, not
+ * keyboard-driven changes). An attribute that stops being readable, or an
+ * input device that reaches end of file or fails, is closed and put on the
+ * timer, which reopens it by path once it returns. Idle cost is therefore
+ * independent of the number of sources. */
+void epollMonitorThread(std::vector<LedSource> sources) {
+    struct Watched {
+        LedSource::Kind kind;
+        int fd;                 /* -1: source gone, retried on the watchdog */
+        std::string path;
+        bool sysfs;             /* Attribute: on sysfs, notifies via POLLPRI */
+        uint16_t id;            /* Attribute: its source id */
+        int lastState;          /* Attribute: last value read */
+        bool notifies;          /* Attribute: a notification has delivered a change */
+        int clockId;            /* Input device: clock of its record timestamps */
+        int ledIds[LED_CNT];    /* Input device: source id per LED code, -1 if not watched */
+        int ledState[LED_CNT];
+        input_event events[16];
+        size_t buffered;
+    };
+    const uint64_t STOP_TAG = ~0ULL, INOTIFY_TAG = ~0ULL - 1, TIMER_TAG = ~0ULL - 2;
+
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    int inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    auto watch = [&](int fd, uint32_t events, uint64_t tag) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = tag;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    };
+    watch(stopFd, EPOLLIN, STOP_TAG);
+    if (inotifyFd != -1)
+        watch(inotifyFd, EPOLLIN, INOTIFY_TAG);
+    watch(timerFd, EPOLLIN, TIMER_TAG);
+
+    std::vector<std::unique_ptr<Watched>> watched;
+    std::vector<int> byWatchDescriptor;
+    size_t polling = 0;
+
+    /* Register an open attribute with epoll (sysfs) and the shared inotify */
+    auto watchAttribute = [&](Watched& w, uint64_t index) {
+        struct statfs fs;
+        w.sysfs = fstatfs(w.fd, &fs) == 0 && fs.f_type == SYSFS_MAGIC;
+        if (w.sysfs)
+            watch(w.fd, EPOLLPRI | EPOLLERR, index);
+        int wd = inotifyFd == -1 ? -1 : inotify_add_watch(inotifyFd, w.path.c_str(), IN_MODIFY | IN_CLOSE_WRITE);
+        if (wd >= 0) {
+            if (static_cast<size_t>(wd) >= byWatchDescriptor.size())
+                byWatchDescriptor.resize(wd + 1, -1);
+            byWatchDescriptor[wd] = static_cast<int>(index);
+        }
+    };
+    for (const LedSource& src : sources) {
+        int fd = src.kind == LedSource::InputDevice ? openEventSource(src.path, true)
+                                                    : open(src.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            std::cerr << "Cannot open LED source " << src.path << ": " << std::strerror(errno) << std::endl;
+            continue;
+        }
+        auto w = std::make_unique<Watched>();
+        w->kind = src.kind;
+        w->fd = fd;
+        w->path = src.path;
+        w->sysfs = false;
+        w->buffered = 0;
+        w->notifies = false;
+        uint64_t index = watched.size();
+
+        if (src.kind == LedSource::Attribute) {
+            std::string name = src.path;
+            size_t slash = name.rfind('/');
+            if (slash != std::string::npos && name.compare(slash + 1, std::string::npos, "brightness") == 0)
+                name = name.substr(0, slash);
+            w->id = registerSource(name.substr(name.rfind('/') + 1));
+            w->lastState = readStateFd(fd);
+            watchAttribute(*w, index);
+            polling++;
+        } else {
+            std::fill(std::begin(w->ledIds), std::end(w->ledIds), -1);
+            unsigned char bits[(LED_CNT + 7) / 8] = {};
+            if (ioctl(fd, EVIOCGBIT(EV_LED, sizeof(bits)), bits) < 0)
+                bits[0] = (1 << LED_NUML) | (1 << LED_CAPSL) | (1 << LED_SCROLLL); /* Not a real device */
+            unsigned char leds[(LED_CNT + 7) / 8] = {};
+            bool known = ioctl(fd, EVIOCGLED(sizeof(leds)), leds) >= 0;
+            for (int code = 0; code < LED_CNT; code++) {
+                w->ledState[code] = known ? (leds[code / 8] >> (code % 8)) & 1 : -1;
+                if (bits[code / 8] & (1 << (code % 8))) {
+                    const char* led = ledName(code);
+                    w->ledIds[code] = registerSource(src.path + ":" + (led ? led : "led" + std::to_string(code)));
+                }
+            }
+            int clockId = CLOCK_MONOTONIC;
+            w->clockId = ioctl(fd, EVIOCSCLOCKID, &clockId) == 0 ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+            watch(fd, EPOLLIN, index);
+        }
+        watched.push_back(std::move(w));
+    }
+
+    auto armWatchdog = [&](bool on) {
+        itimerspec spec{};
+        if (on)
+            spec.it_interval.tv_nsec = spec.it_value.tv_nsec = 100 * 1000000;
+        timerfd_settime(timerFd, 0, &spec, nullptr);
+    };
+    armWatchdog(polling > 0);
+    std::cout << "Watching " << sourceNames.size() << " LEDs from " << watched.size()
+              << " sources on one epoll thread" << std::endl;
+
+    auto sampleAttribute = [&](Watched& w, uint64_t index, bool notified) {
+        if (w.fd == -1) {
+            int fd = open(w.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd != -1 && readStateFd(fd) < 0)
+                close(fd);
+            else if (fd != -1)
+                w.fd = fd;
+            if (w.fd == -1)
+                return;
+            std::cerr << "LED source " << w.path << " is back" << std::endl;
+            watchAttribute(w, index);
+        }
+        int state = readStateFd(w.fd);
+        if (state < 0) {
+            /* Gone (ENODEV once unplugged): a level-triggered POLLERR would
+             * spin, so close it and retry by path on the watchdog */
+            std::cerr << "Cannot read LED source " << w.path << ": " << std::strerror(errno)
+                      << ", retrying every 100 ms" << std::endl;
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, w.fd, nullptr);
+            close(w.fd);
+            w.fd = -1;
+            if (w.notifies) {
+                w.notifies = false;
+                if (polling++ == 0)
+                    armWatchdog(true);
+            }
+            return;
+        }
+        if (state == w.lastState)
+            return;
+        if (w.lastState < 0) {
+            w.lastState = state;
+            return;
+        }
+        if (notified && !w.notifies) {
+            w.notifies = true;
+            if (--polling == 0)
+                armWatchdog(false);
+        }
+        reportChange(w.lastState, state, captureEventTime(), w.id);
+        w.lastState = state;
+    };
+
+    /* Report the LEDs whose state changed unseen (records dropped, or the
+     * device was away); false if the device cannot tell */
+    auto resyncDevice = [&](Watched& w) {
+        unsigned char leds[(LED_CNT + 7) / 8] = {};
+        if (ioctl(w.fd, EVIOCGLED(sizeof(leds)), leds) < 0)
+            return false;
+        for (int code = 0; code < LED_CNT; code++) {
+            int state = (leds[code / 8] >> (code % 8)) & 1;
+            if (w.ledIds[code] >= 0 && w.ledState[code] >= 0 && state != w.ledState[code])
+                reportChange(w.ledState[code], state, captureEventTime(), w.ledIds[code]);
+            w.ledState[code] = state;
+        }
+        return true;
+    };
+
+    auto reopenDevice = [&](Watched& w, uint64_t index) {
+        int fd = openEventSource(w.path, true);
+        if (fd == -1)
+            return;
+        std::cerr << "Input device " << w.path << " is back" << std::endl;
+        w.fd = fd;
+        w.buffered = 0;
+        int clockId = CLOCK_MONOTONIC;
+        w.clockId = ioctl(fd, EVIOCSCLOCKID, &clockId) == 0 ? CLOCK_MONOTONIC : CLOCK_REALTIME;
+        resyncDevice(w);
+        watch(fd, EPOLLIN, index);
+        if (--polling == 0)
+            armWatchdog(false);
+    };
+
+    auto readDevice = [&](Watched& w) {
+        while (true) {
+            ssize_t n = read(w.fd, reinterpret_cast<char*>(w.events) + w.buffered, sizeof(w.events) - w.buffered);
+            if (n <= 0) {
+                if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    /* Unplugged, or the writer went away: retry by path on the watchdog */
+                    std::cerr << "Input device " << w.path << " is gone ("
+                              << (n == 0 ? "end of file" : std::strerror(errno)) << "), retrying every 100 ms"
+                              << std::endl;
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, w.fd, nullptr);
+                    close(w.fd);
+                    w.fd = -1;
+                    if (polling++ == 0)
+                        armWatchdog(true);
+                }
+                return;
+            }
+            w.buffered += n;
+            int64_t kernelToEvent = toEventClock(w.clockId, 0);
+            size_t count = w.buffered / sizeof(input_event);
+            for (size_t i = 0; i < count; i++) {
+                const input_event& ev = w.events[i];
+                if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+                    resyncDevice(w);
+                    continue;
+                }
+                if (ev.type != EV_LED || ev.code >= LED_CNT || w.ledIds[ev.code] < 0)
+                    continue;
+                int state = ev.value ? 1 : 0;
+                int& last = w.ledState[ev.code];
+                if (last == -1)
+                    last = !state;
+                if (state != last) {
+                    reportChange(last, state, static_cast<int64_t>(ev.input_event_sec) * 1000000000
+                                              + static_cast<int64_t>(ev.input_event_usec) * 1000 + kernelToEvent,
+                                 w.ledIds[ev.code]);
+                    last = state;
+                }
+            }
+            size_t consumed = count * sizeof(input_event);
+            w.buffered -= consumed;
+            std::memmove(w.events, reinterpret_cast<char*>(w.events) + consumed, w.buffered);
+        }
+    };
+
+    epoll_event ready[64];
+    bool stop = false;
+    while (running && !stop) {
+        int n = epoll_wait(epollFd, ready, 64, -1);
+        monitorWakeups++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        bool watchdogDue = false;
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = ready[i].data.u64;
+            if (tag == STOP_TAG) {
+                stop = true;
+            } else if (tag == TIMER_TAG) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) < 0) {}
+                watchdogDue = true; /* After the notifications, so they get credit for changes they carry */
+            } else if (tag == INOTIFY_TAG) {
+                alignas(inotify_event) char buf[4096];
+                ssize_t len;
+                while ((len = read(inotifyFd, buf, sizeof(buf))) > 0) {
+                    for (char* p = buf; p < buf + len; p += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(p)->len) {
+                        int wd = reinterpret_cast<inotify_event*>(p)->wd;
+                        if (wd < 0 || static_cast<size_t>(wd) >= byWatchDescriptor.size() || byWatchDescriptor[wd] < 0)
+                            continue;
+                        Watched& w = *watched[byWatchDescriptor[wd]];
+                        if (w.fd != -1)
+                            sampleAttribute(w, byWatchDescriptor[wd], !w.sysfs);
+                    }
+                }
+            } else if (watched[tag]->kind == LedSource::Attribute) {
+                if (watched[tag]->fd != -1)
+                    sampleAttribute(*watched[tag], tag, true);
+            } else if (watched[tag]->fd != -1) {
+                readDevice(*watched[tag]);
+            }
+        }
+        if (watchdogDue)
+            for (size_t index = 0; index < watched.size(); index++) {
+                Watched& w = *watched[index];
+                if (w.kind == LedSource::Attribute && !w.notifies)
+                    sampleAttribute(w, index, false);
+                else if (w.kind == LedSource::InputDevice && w.fd == -1)
+                    reopenDevice(w, index);
+            }
+    }
+
+    for (auto& w : watched)
+        if (w->fd != -1)
+            close(w->fd);
+    close(timerFd);
+    if (inotifyFd != -1)
+        close(inotifyFd);
+    close(epollFd);
+}
+
+/* Pipeline source: runs the monitor for the configured LEDs on the
+ * pipeline's source thread (epoll for several, the dedicated sysfs or evdev
+ * monitor for one) and emits what it reports. Returns on requestStop(). */
+struct MonitorSource {
+    std::vector<LedSource> sources;
+    WaitMode mode;
+
+    template <typename Emit>
+    void run(Emit& emit) {
+        threadEmitter = {&emit, [](void* context, const LogEvent& ev) { (*static_cast<Emit*>(context))(ev); }};
+        if (sources.size() > 1)
+            epollMonitorThread(sources);
+        else if (sources.front().kind == LedSource::InputDevice)
+            evdevMonitorThread(sources.front().path);
+        else
+            monitorThread(sources.front().path, mode);
+        threadEmitter = {nullptr, nullptr};
+    }
+};
+
+/* The caps logger: monitor | logger thread: wall clock -> text line, fanned
+ * out to the log file, console and subscribers, each on its own thread.
+ * A stalled disk fills the file's fan-out ring, then the hop; both follow
+ * logQueuePolicy (by default they drop rather than block, so the monitor
+ * never waits). The console and subscriber rings always drop, so a stalled
+ * terminal or subscriber never stalls the disk. */
+using LogHop = ThreadHop<LogEvent, logQueueCapacity>;
+using LogFanOut = FanOut<LogLine, 4096, LogWriterSink, ConsoleSink, SubscriberSink>;
+using CapsLogger = Pipeline<MonitorSource, LogHop, WallClockStage, FormatStage, LogFanOut>;
+
+/* Read-type syscalls issued by this process so far (syscr in /proc/self/io) */
+long readSyscalls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    long value;
+    while (io >> key >> value)
+        if (key == "syscr:")
+            return value;
+    return -1;
+}
+
+/* Benchmark: per-sample cost of reopening with ifstream vs pread on a kept fd */
+void benchRead(std::string path, int samples) {
+    char scratch[] = "/tmp/caps_read_XXXXXX";
+    if (path.empty()) {
+        int fd = mkstemp(scratch);
+        if (fd == -1 || write(fd, "1\n", 2) != 2)
+            return;
+        close(fd);
+        path = scratch;
+    }
+
+    auto run = [&](const char* name, int opensPerSample, auto&& sampleFn) {
+        long sum = 0;
+        long syscr = readSyscalls();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < samples; i++)
+            sum += sampleFn();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+        double reads = static_cast<double>(readSyscalls() - syscr) / samples;
+        std::cout << "  " << name << ": " << ns << " ns/sample, " << reads << " read + "
+                  << opensPerSample << " open + " << opensPerSample << " close syscalls/sample"
+                  << " (state sum " << sum << ")" << std::endl;
+    };
+
+    std::cout << "Read benchmark on " << path << ", " << samples << " samples" << std::endl;
+    run("ifstream per sample", 1, [&]() { return getCapsLockState(path); });
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    run("pread on kept fd   ", 0, [&]() { return readStateFd(fd); });
+    close(fd);
+
+    if (path == scratch)
+        unlink(scratch);
+}
+
+WaitMode parseWaitMode(const std::string& name) {
+    if (name == "sysfs") return WaitMode::SysfsNotify;
+    if (name == "inotify") return WaitMode::Inotify;
+    if (name == "poll") return WaitMode::Sleep;
+    return WaitMode::Auto;
+}
+
+HopFull parseHopFull(const std::string& name) {
+    if (name == "block") return HopFull::Block;
+    if (name == "drop-oldest") return HopFull::DropOldest;
+    if (name == "coalesce") return HopFull::Coalesce;
+    return HopFull::DropNewest;
+}
+
+/* Benchmark: detection latency and idle wakeups per wait mode.
+ * A scratch file stands in for the attribute; a writer toggles it and the
+ * time until the monitor's message reaches the queue is measured. */
+void benchDetect(const std::string& modeName, int toggles) {
+    char path[] = "/tmp/caps_detect_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1 || pwrite(fd, "0\n", 2, 0) != 2) {
+        std::cerr << "Cannot create scratch file" << std::endl;
+        return;
+    }
+
+    running = true;
+    uint64_t drained;
+    while (read(stopFd, &drained, sizeof(drained)) > 0) {}
+    std::thread monitor(monitorThread, std::string(path), parseWaitMode(modeName));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::vector<double> latencyUs;
+    int missed = 0;
+    for (int i = 1; i <= toggles; i++) {
+        auto written = std::chrono::steady_clock::now();
+        if (pwrite(fd, (i % 2) ? "1\n" : "0\n", 2, 0) != 2)
+            break;
+
+        LogEvent ev;
+        if (logRing.tryPop(ev) || (logRing.waitForData(1000, stopFd) && logRing.tryPop(ev)))
+            latencyUs.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - written).count());
+        else
+            missed++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10 + (i * 7) % 20));
+    }
+
+    unsigned long before = monitorWakeups;
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    unsigned long idleWakeups = monitorWakeups - before;
+
+    requestStop();
+    monitor.join();
+    close(fd);
+    unlink(path);
+    LogEvent leftover;
+    while (logRing.tryPop(leftover)) {}
+
+    std::sort(latencyUs.begin(), latencyUs.end());
+    auto pct = [&](double p) { return latencyUs.empty() ? 0.0 : latencyUs[static_cast<size_t>(p * (latencyUs.size() - 1))]; };
+    std::cout << "  " << modeName << ": latency p50 " << pct(0.5) << " us, p99 " << pct(0.99)
+              << " us, " << missed << " missed, " << idleWakeups << " idle wakeups/s" << std::endl;
+}
+
+/* Benchmark: monitor -> logger handoff. Producers enqueue `events` records
+ * between them while one consumer drains; reports throughput, enqueue latency
+ * (successful calls only) and how often the consumer had to be woken. */
+template <typename PushFn, typename ConsumeFn>
+void runHandoffBench(const char* name, int producers, long events, PushFn push, ConsumeFn consume) {
+    std::vector<std::vector<uint32_t>> latencyNs(producers);
+    std::atomic<long> fullRetries(0);
+    unsigned long wakeups = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&]() { wakeups = consume(events); });
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p]() {
+            long share = events / producers + (p < events % producers ? 1 : 0);
+            std::vector<uint32_t>& lat = latencyNs[p];
+            lat.reserve(share);
+            for (long i = 0; i < share; i++) {
+                for (;;) {
+                    auto t0 = std::chrono::steady_clock::now();
+                    bool ok = push(p, i);
+                    auto t1 = std::chrono::steady_clock::now();
+                    if (ok) {
+                        lat.push_back(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()));
+                        break;
+                    }
+                    fullRetries.fetch_add(1, std::memory_order_relaxed);
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    consumer.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint32_t> all;
+    for (auto& lat : latencyNs)
+        all.insert(all.end(), lat.begin(), lat.end());
+    std::sort(all.begin(), all.end());
+    auto pct = [&](double q) { return all.empty() ? 0u : all[static_cast<size_t>(q * (all.size() - 1))]; };
+    std::cout << "  " << name << ": " << static_cast<long>(events / seconds) << " events/s, enqueue p50 "
+              << pct(0.5) << " ns, p99 " << pct(0.99) << " ns, " << wakeups << " consumer wakeups, "
+              << fullRetries << " full retries" << std::endl;
+}
+
+void benchRing(long events) {
+    std::cout << "Handoff benchmark, " << events << " events" << std::endl;
+
+    /* The previous design: formatted string into std::queue under a mutex */
+    for (int producers : {1, 4}) {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::queue<std::string> queue;
+        const std::string msg = "2024-01-01 00:00:00 : [off]->[on]";
+        std::string name = "mutex + std::queue<string>, " + std::to_string(producers) + " producer(s)";
+        runHandoffBench(name.c_str(), producers, events,
+            [&](int, long) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push(msg);
+                }
+                cv.notify_one();
+                return true;
+            },
+            [&](long total) {
+                unsigned long waits = 0;
+                long seen = 0;
+                std::unique_lock<std::mutex> lock(mutex);
+                while (seen < total) {
+                    if (queue.empty()) {
+                        cv.wait(lock, [&]{ return !queue.empty(); });
+                        waits++;
+                    }
+                    while (!queue.empty()) {
+                        std::string m = std::move(queue.front());
+                        queue.pop();
+                        lock.unlock();
+                        seen++;
+                        lock.lock();
+                    }
+                }
+                return waits;
+            });
+    }
+
+    auto ringRun = [&](const char* name, int producers, auto& ring) {
+        runHandoffBench(name, producers, events,
+            [&](int p, long i) {
+                LogEvent ev{i, static_cast<uint8_t>(p), 0, 1};
+                return ring.tryPush(ev);
+            },
+            [&](long total) {
+                long seen = 0;
+                LogEvent ev;
+                while (seen < total) {
+                    while (ring.tryPop(ev))
+                        seen++;
+                    if (seen < total)
+                        ring.waitForData(100);
+                }
+                return ring.wakeups();
+            });
+    };
+    auto spsc = std::make_unique<SpscRing<LogEvent>>();
+    ringRun("SPSC ring, 1 producer", 1, *spsc);
+    auto mpsc1 = std::make_unique<MpscRing<LogEvent>>();
+    ringRun("MPSC ring, 1 producer", 1, *mpsc1);
+    auto mpsc4 = std::make_unique<MpscRing<LogEvent>>();
+    ringRun("MPSC ring, 4 producers", 4, *mpsc4);
+}
+
+/* Benchmark: ns per timestamp, old std::localtime + stringstream path vs
+ * localtime_r + strftime vs the cached formatter. `perSecond` calls share
+ * each second, like a burst of events; 1 means every call is a new second. */
+void benchTimestamp(long calls) {
+    std::time_t base = std::time(nullptr);
+    std::cout << "Timestamp benchmark, " << calls << " calls per run" << std::endl;
+
+    auto run = [&](const char* name, long perSecond, auto&& formatFn) {
+        size_t total = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < calls; i++)
+            total += formatFn(base + i / perSecond, (i * 7919) % 1000000000);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+        std::cout << "  " << name << ", " << perSecond << " per second: " << ns << " ns/timestamp"
+                  << " (" << total / calls << " chars)" << std::endl;
+    };
+
+    for (long perSecond : {1000L, 1L}) {
+        run("localtime + stringstream", perSecond, [](std::time_t sec, long nsec) {
+            std::tm* tm_now = std::localtime(&sec);
+            std::stringstream ss;
+            ss << std::put_time(tm_now, "%Y-%m-%d %H:%M:%S") << '.' << std::setw(9) << std::setfill('0') << nsec;
+            return ss.str().size();
+        });
+        run("localtime_r + strftime  ", perSecond, [](std::time_t sec, long nsec) {
+            std::tm tm_buf;
+            localtime_r(&sec, &tm_buf);
+            char buf[64];
+            size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_buf);
+            return n + std::snprintf(buf + n, sizeof(buf) - n, ".%09ld", nsec);
+        });
+        TimestampFormatter formatter;
+        run("cached formatter        ", perSecond, [&](std::time_t sec, long nsec) {
+            char buf[TimestampFormatter::MAX_LEN];
+            return formatter.format(sec, nsec, buf);
+        });
+    }
+
+    /* Cross-check the cache against localtime_r across minute/hour/day rollovers */
+    TimestampFormatter formatter;
+    long mismatches = 0;
+    for (std::time_t sec = base; sec < base + 3 * 86400; sec += 7) {
+        std::tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        char expected[32], got[TimestampFormatter::MAX_LEN];
+        std::strftime(expected, sizeof(expected), "%Y-%m-%d %H:%M:%S", &tm_buf);
+        if (formatter.format(sec, -1, got) != 19 || std::memcmp(expected, got, 19) != 0)
+            mismatches++;
+    }
+    std::cout << "  cache vs localtime_r over 3 days: " << mismatches << " mismatches" << std::endl;
+}
+
+/* Benchmark: cost of stamping an event and of turning it into wall time,
+ * plus a check that the logged times come out strictly increasing */
+void benchClock(long calls) {
+    std::cout << "Clock benchmark, " << calls << " calls per run, event clock "
+              << eventClockName() << std::endl;
+
+    auto run = [&](const char* name, auto&& fn) {
+        int64_t sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < calls; i++)
+            sink += fn();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+        std::cout << "  " << name << ": " << ns << " ns/call" << (sink == 0 ? " (?)" : "") << std::endl;
+    };
+    run("clock_gettime(CLOCK_MONOTONIC_RAW)", []() { return clockNs(CLOCK_MONOTONIC_RAW); });
+    run("clock_gettime(CLOCK_MONOTONIC)    ", []() { return clockNs(CLOCK_MONOTONIC); });
+    run("clock_gettime(CLOCK_REALTIME)     ", []() { return clockNs(CLOCK_REALTIME); });
+    run("captureEventTime()                ", []() { return captureEventTime(); });
+
+    WallClockAnchor anchor;
+    std::vector<int64_t> captured(calls);
+    for (long i = 0; i < calls; i++)
+        captured[i] = captureEventTime();
+    int64_t last = INT64_MIN;
+    long ties = 0, backwards = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < calls; i++) {
+        if (i > 0 && captured[i] == captured[i - 1])
+            ties++;
+        int64_t wall = anchor.toWallNs(captured[i]);
+        if (wall <= last)
+            backwards++;
+        last = wall;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / calls;
+    std::cout << "  WallClockAnchor::toWallNs          : " << ns << " ns/call, " << ties
+              << " equal captures, " << backwards << " non-increasing wall times" << std::endl;
+    std::cout << "  anchor vs CLOCK_REALTIME now: " << (anchor.toWallNs(captureEventTime()) - clockNs(CLOCK_REALTIME))
+              << " ns" << std::endl;
+}
+
+/* Benchmark source: `events` toggles in bursts of 64, 1 ms apart */
+struct BurstSource {
+    long events;
+
+    template <typename Emit>
+    void run(Emit& emit) {
+        for (long i = 0; i < events; i++) {
+            emit(LogEvent{captureEventTime(), 0, static_cast<int8_t>(i % 2), static_cast<int8_t>((i + 1) % 2)});
+            if (i % 64 == 63)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+};
+
+/* Benchmark: rotation under load. Events go through the real LogWriterSink
+ * in a scratch directory with a small segment size; afterwards all segments,
+ * compressed or not, are read back to check no line was lost or doubled. */
+void benchRotate(long events) {
+    char dir[] = "/tmp/caps_rotate_XXXXXX";
+    char cwd[4096];
+    if (!mkdtemp(dir) || !getcwd(cwd, sizeof(cwd)) || chdir(dir) != 0) {
+        std::cerr << "Cannot create scratch directory" << std::endl;
+        return;
+    }
+    std::cout << "Rotation benchmark, " << events << " events, " << rotateMaxBytes << " byte segments in " << dir << std::endl;
+
+    logToConsole = false;
+    LogWriterSink writer;
+    if (!writer.open())
+        return;
+    Pipeline<BurstSource, ThreadHop<LogEvent, 4096>, WallClockStage, FormatStage, LogWriterSink>
+        logger(BurstSource{events}, ThreadHop<LogEvent, 4096>(), WallClockStage(), FormatStage(), std::move(writer));
+    logger.run();
+    logger.sink().close();
+
+    auto count = [](const char* cmd) {
+        long n = -1;
+        if (FILE* out = popen(cmd, "r")) {
+            if (std::fscanf(out, "%ld", &n) != 1)
+                n = -1;
+            pclose(out);
+        }
+        return n;
+    };
+    const char* all = "(cat caps_lock_log*.txt; gzip -dc caps_lock_log-*.gz) 2>/dev/null";
+    long lines = count((std::string(all) + " | wc -l").c_str());
+    long unique = count((std::string(all) + " | sort -u | wc -l").c_str());
+    long compressed = count("ls caps_lock_log-*.gz 2>/dev/null | wc -l");
+    std::cout << "  " << lines << " lines read back (" << unique << " distinct), " << events - lines
+              << " missing, " << compressed << " segments gzipped" << std::endl;
+
+    if (chdir(cwd) != 0) {}
+    std::string cleanup = std::string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0) {}
+}
+
+/* Benchmark sink standing in for a slow terminal: 1 ms per line */
+struct SlowSink {
+    const char* name() const { return "slow console"; }
+    void operator()(const LogLine&) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+};
+
+/* Benchmark: sink isolation. Bursts go to the real log file, a sink that
+ * takes 1 ms per line and a subscriber socket whose one client never
+ * reads; the file must get every line with low lag while the other two
+ * fall behind and drop on their own. */
+void benchFanOut(long events) {
+    char dir[] = "/tmp/caps_fanout_XXXXXX";
+    char cwd[4096];
+    if (!mkdtemp(dir) || !getcwd(cwd, sizeof(cwd)) || chdir(dir) != 0) {
+        std::cerr << "Cannot create scratch directory" << std::endl;
+        return;
+    }
+    std::cout << "Fan-out benchmark, " << events << " events, file + slow console + stalled subscriber" << std::endl;
+
+    LogWriterSink writer;
+    SubscriberSink subscribers;
+    if (!writer.open() || !subscribers.open("caps_lock_log.sock"))
+        return;
+    int stalled = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, "caps_lock_log.sock");
+    if (connect(stalled, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+        std::cerr << "Subscriber connect failed: " << std::strerror(errno) << std::endl;
+
+    using Sinks = FanOut<LogLine, 1024, LogWriterSink, SlowSink, SubscriberSink>;
+    Pipeline<BurstSource, ThreadHop<LogEvent, 4096>, WallClockStage, FormatStage, Sinks>
+        logger(BurstSource{events}, ThreadHop<LogEvent, 4096>(), WallClockStage(), FormatStage(),
+               Sinks(std::move(writer), SlowSink(), std::move(subscribers)));
+    auto start = std::chrono::steady_clock::now();
+    logger.run();
+    std::vector<SinkStats> before = logger.sink().stats();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "  source done after " << ms << " ms, queues at that point:" << std::endl;
+    printSinkStats(before);
+    logger.sink().close();
+    ::close(stalled);
+
+    long lines = 0;
+    if (FILE* in = fopen("caps_lock_log.txt", "r")) {
+        for (int c; (c = fgetc(in)) != EOF;)
+            lines += c == '\n';
+        fclose(in);
+    }
+    std::cout << "  after close:" << std::endl;
+    printSinkStats(logger.sink().stats());
+    std::cout << "  log file has " << lines << " of " << events << " lines" << std::endl;
+
+    if (chdir(cwd) != 0) {}
+    std::string cleanup = std::string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0) {}
+}
+
+/* Benchmark source: `events` toggles spread over `leds` LEDs, as fast as possible */
+struct FloodSource {
+    long events;
+    int leds;
+
+    template <typename Emit>
+    void run(Emit& emit) {
+        for (long i = 0; i < events; i++) {
+            int8_t state = static_cast<int8_t>((i / leds) % 2);
+            emit(LogEvent{captureEventTime(), static_cast<uint16_t>(i % leds), state, static_cast<int8_t>(1 - state)});
+        }
+    }
+};
+
+/* Benchmark stand-in for a stalled disk: a FIFO in place of
+ * caps_lock_log.txt, read back at ~1 us per line; counts the transitions
+ * and the events reported lost in what arrives */
+class SlowLogReader {
+public:
+    explicit SlowLogReader(const char* path) {
+        thread_ = std::thread([this, path] {
+            int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return;
+            char buf[4096];
+            std::string partial;
+            ssize_t n;
+            while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+                partial.append(buf, n);
+                size_t start = 0, end;
+                while ((end = partial.find('\n', start)) != std::string::npos) {
+                    size_t lost = partial.find(" : lost ", start);
+                    if (lost < end)
+                        reportedLost += std::strtoul(partial.c_str() + lost + 8, nullptr, 10);
+                    else
+                        transitions++;
+                    lines++;
+                    start = end + 1;
+                }
+                partial.erase(0, start);
+                std::this_thread::sleep_for(std::chrono::microseconds(lines - paced));
+                paced = lines;
+            }
+            ::close(fd);
+        });
+    }
+
+    void join() { thread_.join(); }
+
+    long lines = 0;
+    long transitions = 0;
+    unsigned long reportedLost = 0;
+
+private:
+    long paced = 0;
+    std::thread thread_;
+};
+
+/* Resident set size in KiB (/proc/self/statm) */
+long residentKiB() {
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Samples the resident set every millisecond while `run` runs, returns the
+ * peak growth in KiB */
+template <typename Run>
+long peakGrowthKiB(Run run) {
+    long base = residentKiB();
+    std::atomic<long> peak{base};
+    std::atomic<bool> done{false};
+    std::thread sampler([&] {
+        while (!done.load()) {
+            peak.store(std::max(peak.load(), residentKiB()));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    run();
+    done.store(true);
+    sampler.join();
+    return std::max(peak.load(), residentKiB()) - base;
+}
+
+/* Benchmark: the logger under a flood it cannot keep up with, per
+ * policy, in the real CapsLogger topology (hop, wall clock, format, fan-out)
+ * with the log file stalled (SlowLogReader); the console is off and nobody
+ * subscribes. Checks every event is either in the file or reported in a
+ * lost marker there (the file ring's markers include the queue's it
+ * dropped), and that memory stays at the rings' fixed size; the old unbounded queue
+ * is run into the same stalled file for comparison. */
+void benchQueue(long events) {
+    const int leds = 8;
+    char dir[] = "/tmp/caps_queue_XXXXXX";
+    char cwd[4096];
+    if (!mkdtemp(dir) || !getcwd(cwd, sizeof(cwd)) || chdir(dir) != 0) {
+        std::cerr << "Cannot create scratch directory" << std::endl;
+        return;
+    }
+    std::cout << "Queue benchmark, " << events << " events from " << leds << " LEDs into a ~1 us/line log file, "
+              << logQueueCapacity << " slot queue (" << logQueueCapacity * sizeof(LogEvent) / 1024
+              << " KiB) and 4096 line file ring (" << 4096 * sizeof(LogLine) / 1024 << " KiB)" << std::endl;
+    bool console = logToConsole;
+    LogFormat format = logFormat;
+    HopFull configured = logQueuePolicy;
+    logToConsole = false;
+    logFormat = LogFormat::Text;
+
+    for (HopFull policy : {HopFull::Block, HopFull::DropNewest, HopFull::DropOldest, HopFull::Coalesce}) {
+        logQueuePolicy = policy;
+        unlink("caps_lock_log.txt");
+        if (mkfifo("caps_lock_log.txt", 0644) != 0) {
+            std::cerr << "Cannot create log FIFO: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        SlowLogReader reader("caps_lock_log.txt");
+        LogWriterSink writer;
+        if (!writer.open())
+            break;
+        using Logger = Pipeline<FloodSource, LogHop, WallClockStage, FormatStage, LogFanOut>;
+        auto logger = std::make_unique<Logger>(FloodSource{events, leds}, LogHop(policy), WallClockStage(),
+                                               FormatStage(), LogFanOut(std::move(writer), ConsoleSink(),
+                                                                        SubscriberSink()));
+        auto start = std::chrono::steady_clock::now();
+        int64_t producerCpuNs = 0;
+        long growth = peakGrowthKiB([&] {
+            int64_t cpuStart = clockNs(CLOCK_THREAD_CPUTIME_ID);
+            logger->run(); /* The source runs on this thread */
+            producerCpuNs = clockNs(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+            logger->sink().close();
+            reader.join();
+        });
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        unsigned long hopLost = logger->part<0>().drops();
+        unsigned long fileLost = logger->sink().stats().front().dropped;
+        bool exact = reader.transitions + static_cast<long>(reader.reportedLost) == events;
+        std::cout << "  " << std::setw(11) << hopFullName(policy) << ": " << reader.transitions << " in the file, "
+                  << reader.reportedLost << " lost in markers (" << hopLost << " events dropped by the queue, "
+                  << fileLost << " lines by the file ring), " << (exact ? "accounting exact" : "ACCOUNTING MISMATCH")
+                  << ", peak RSS +" << growth << " KiB, " << ms << " ms (producer CPU " << producerCpuNs / 1000000
+                  << " ms)" << std::endl;
+    }
+    logToConsole = console;
+    logFormat = format;
+    logQueuePolicy = configured;
+
+    /* The old logQueue: std::queue behind a mutex, no bound */
+    unlink("caps_lock_log.txt");
+    if (mkfifo("caps_lock_log.txt", 0644) == 0) {
+        SlowLogReader reader("caps_lock_log.txt");
+        int fd = ::open("caps_lock_log.txt", O_WRONLY | O_CLOEXEC);
+        std::queue<LogEvent> queue;
+        std::mutex lock;
+        std::atomic<bool> producing{true};
+        auto start = std::chrono::steady_clock::now();
+        long growth = peakGrowthKiB([&] {
+            std::thread consumer([&] {
+                char line[EVENT_TEXT_MAX + 1];
+                while (true) {
+                    LogEvent ev;
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        if (queue.empty()) {
+                            if (!producing.load())
+                                break;
+                            continue;
+                        }
+                        ev = queue.front();
+                        queue.pop();
+                    }
+                    size_t len = formatEvent(ev, clockNs(CLOCK_REALTIME), line);
+                    line[len++] = '\n';
+                    if (!writeFully(fd, line, len))
+                        break;
+                }
+                ::close(fd);
+            });
+            auto emit = [&](const LogEvent& ev) {
+                std::lock_guard<std::mutex> guard(lock);
+                queue.push(ev);
+            };
+            FloodSource{events, leds}.run(emit);
+            producing.store(false);
+            consumer.join();
+            reader.join();
+        });
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << std::setw(11) << "unbounded" << ": " << reader.transitions
+                  << " in the file, 0 lost, peak RSS +" << growth << " KiB, " << ms << " ms" << std::endl;
+    }
+
+    if (chdir(cwd) != 0) {}
+    std::string cleanup = std::string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0) {}
+}
+
+/* Benchmark: CPU the epoll monitor spends per watched LED. N scratch
+ * attributes are watched by one epollMonitorThread; its thread CPU time is
+ * measured while idle and while every source toggles once per second, and
+ * scaled to CPU time per source per hour. */
+void benchEpoll(int sources, int seconds) {
+    char dir[] = "/tmp/caps_epoll_XXXXXX";
+    if (!mkdtemp(dir)) {
+        std::cerr << "Cannot create scratch directory" << std::endl;
+        return;
+    }
+    std::vector<LedSource> leds;
+    std::vector<int> fds;
+    for (int i = 0; i < sources; i++) {
+        std::string path = std::string(dir) + "/led" + std::to_string(i);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1 || pwrite(fd, "0\n", 2, 0) != 2) {
+            std::cerr << "Cannot create " << path << std::endl;
+            return;
+        }
+        fds.push_back(fd);
+        leds.push_back({LedSource::Attribute, path});
+    }
+
+    running = true;
+    uint64_t drained;
+    while (read(stopFd, &drained, sizeof(drained)) > 0) {}
+    sourceNames.clear();
+    std::cout.setstate(std::ios::failbit); /* Keep the monitor's banner out of the table */
+    std::thread monitor(epollMonitorThread, leds);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::cout.clear();
+    clockid_t cpuClock;
+    pthread_getcpuclockid(monitor.native_handle(), &cpuClock);
+
+    long received = 0;
+    LogEvent ev;
+    auto drain = [&]() {
+        while (logRing.tryPop(ev))
+            received++;
+    };
+    /* One toggle each, so every source proves it notifies and leaves the watchdog */
+    for (int fd : fds)
+        if (pwrite(fd, "1\n", 2, 0) != 2) {}
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    drain();
+
+    auto phase = [&](const char* name, bool toggle) {
+        long before = received;
+        unsigned long wakeups = monitorWakeups;
+        int64_t cpu0 = clockNs(cpuClock);
+        auto start = std::chrono::steady_clock::now();
+        long toggles = 0;
+        for (int tick = 0; tick < seconds * 100; tick++) {
+            /* Spread each second's N toggles over 100 ticks of 10 ms */
+            if (toggle) {
+                for (int i = tick % 100; i < sources; i += 100) {
+                    int round = tick / 100;
+                    if (pwrite(fds[i], (round % 2) ? "1\n" : "0\n", 2, 0) == 2)
+                        toggles++;
+                }
+            }
+            std::this_thread::sleep_until(start + std::chrono::milliseconds(10 * (tick + 1)));
+            drain();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        drain();
+        double cpuNs = static_cast<double>(clockNs(cpuClock) - cpu0);
+        double perSourceHourMs = cpuNs / sources / seconds * 3600.0 / 1e6;
+        std::cout << "  " << sources << " sources, " << name << ": " << perSourceHourMs
+                  << " ms CPU per source per hour, " << (monitorWakeups - wakeups) << " wakeups, "
+                  << received - before << "/" << toggles << " changes logged" << std::endl;
+    };
+    phase("idle              ", false);
+    phase("1 toggle/s/source ", true);
+
+    requestStop();
+    monitor.join();
+    drain();
+    for (size_t i = 0; i < fds.size(); i++) {
+        close(fds[i]);
+        unlink(leds[i].path.c_str());
+    }
+    rmdir(dir);
+}
+
+/* Parts for the pipeline benchmark: a counter source, three small stages
+ * (number, filter, mix) and a summing sink. The hand-written loop below
+ * does the same work, so the difference is what the framework costs. */
+struct CountingSource {
+    long events;
+
+    template <typename Emit>
+    void run(Emit& emit) {
+        for (long i = 0; i < events; i++)
+            emit(static_cast<uint64_t>(i));
+    }
+};
+
+struct Numbered {
+    uint64_t value;
+    uint64_t seq;
+};
+
+struct NumberStage {
+    uint64_t seq = 0;
+    template <typename Next>
+    void operator()(uint64_t value, Next& next) { next(Numbered{value, seq++}); }
+};
+
+struct FilterStage {
+    template <typename Next>
+    void operator()(const Numbered& item, Next& next) {
+        if (item.value % 7 != 3)
+            next(item);
+    }
+};
+
+struct MixStage {
+    template <typename Next>
+    void operator()(const Numbered& item, Next& next) { next((item.value * 2654435761u) ^ item.seq); }
+};
+
+struct SumSink {
+    uint64_t sum = 0;
+    long count = 0;
+    void operator()(uint64_t value) {
+        sum += value;
+        count++;
+    }
+};
+
+/* Benchmark: per-event cost of a 3-stage pipeline, inlined on one thread and
+ * with a thread hop in front of the sink, against the same work hand-written */
+void benchPipeline(long events) {
+    std::cout << "Pipeline benchmark, " << events << " events, 3 stages" << std::endl;
+    auto report = [&](const char* name, std::chrono::steady_clock::time_point start, uint64_t sum, long count) {
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / events;
+        std::cout << "  " << name << ": " << ns << " ns/event (" << count << " reached the sink, sum " << sum % 1000 << ")" << std::endl;
+        return ns;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sum = 0, seq = 0;
+    long count = 0;
+    for (long i = 0; i < events; i++) {
+        uint64_t value = static_cast<uint64_t>(i);
+        uint64_t n = seq++;
+        if (value % 7 != 3) {
+            sum += (value * 2654435761u) ^ n;
+            count++;
+        }
+    }
+    double base = report("hand-written loop        ", start, sum, count);
+
+    Pipeline<CountingSource, NumberStage, FilterStage, MixStage, SumSink> inlined(
+        CountingSource{events}, NumberStage(), FilterStage(), MixStage(), SumSink());
+    start = std::chrono::steady_clock::now();
+    inlined.run();
+    double one = report("Pipeline, one thread     ", start, inlined.sink().sum, inlined.sink().count);
+
+    using Hop = ThreadHop<uint64_t, 4096>;
+    Pipeline<CountingSource, NumberStage, FilterStage, MixStage, Hop, SumSink> hopped(
+        CountingSource{events}, NumberStage(), FilterStage(), MixStage(), Hop(), SumSink());
+    start = std::chrono::steady_clock::now();
+    hopped.run();
+    double two = report("Pipeline, hop before sink", start, hopped.sink().sum, hopped.sink().count);
+
+    std::cout << "  framework overhead: " << one - base << " ns/event inlined, "
+              << two - base << " ns/event with the thread hop" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
     std::string capsPath = "/sys/class/leds/input3::capslock/brightness";
+    WaitMode mode = WaitMode::Auto;
+    std::vector<LedSource> ledSources;
+    bool allLeds = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench-detect") {
+            int toggles = (i + 1 < argc) ? std::atoi(argv[i + 1]) : 50;
+            std::cout << "Detection benchmark, " << toggles << " toggles per mode" << std::endl;
+            for (const char* name : {"auto", "sysfs", "poll"})
+                benchDetect(name, toggles);
+            return 0;
+        }
+        if (arg == "--bench-ring") {
+            benchRing(i + 1 < argc ? std::atol(argv[i + 1]) : 2000000);
+            return 0;
+        }
+        if (arg == "--bench-timestamp") {
+            benchTimestamp(i + 1 < argc ? std::atol(argv[i + 1]) : 1000000);
+            return 0;
+        }
+        if (arg == "--bench-clock") {
+            benchClock(i + 1 < argc ? std::atol(argv[i + 1]) : 1000000);
+            return 0;
+        }
+        if (arg == "--bench-rotate") {
+            if (rotateMaxBytes == 0)
+                rotateMaxBytes = 16 * 1024;
+            benchRotate(i + 1 < argc ? std::atol(argv[i + 1]) : 20000);
+            return 0;
+        }
+        if (arg == "--bench-fanout") {
+            benchFanOut(i + 1 < argc ? std::atol(argv[i + 1]) : 20000);
+            return 0;
+        }
+        if (arg == "--bench-queue") {
+            benchQueue(i + 1 < argc ? std::atol(argv[i + 1]) : 2000000);
+            return 0;
+        }
+        if (arg == "--bench-epoll") {
+            int seconds = i + 2 < argc ? std::atoi(argv[i + 2]) : 3;
+            std::cout << "Epoll monitor benchmark, " << seconds << " s per phase" << std::endl;
+            if (i + 1 < argc)
+                benchEpoll(std::atoi(argv[i + 1]), seconds);
+            else
+                for (int n : {10, 100, 500})
+                    benchEpoll(n, seconds);
+            return 0;
+        }
+        if (arg == "--bench-pipeline") {
+            benchPipeline(i + 1 < argc ? std::atol(argv[i + 1]) : 10000000);
+            return 0;
+        }
+        if (arg == "--bench-read") {
+            benchRead(i + 1 < argc ? argv[i + 1] : "", i + 2 < argc ? std::atoi(argv[i + 2]) : 200000);
+            return 0;
+        }
+        if (arg.rfind("--mode=", 0) == 0)
+            mode = parseWaitMode(arg.substr(7));
+        else if (arg.rfind("--evdev=", 0) == 0)
+            ledSources.push_back({LedSource::InputDevice, arg.substr(8)});
+        else if (arg == "--all-leds")
+            allLeds = true;
+        else if (arg == "--log-format=binary")
+            logFormat = LogFormat::Binary;
+        else if (arg == "--log-format=text")
+            logFormat = LogFormat::Text;
+        else if (arg.rfind("--rotate-size=", 0) == 0)
+            rotateMaxBytes = std::strtoul(arg.c_str() + 14, nullptr, 10);
+        else if (arg.rfind("--rotate-interval=", 0) == 0)
+            rotateIntervalSec = std::atol(arg.c_str() + 18);
+        else if (arg.rfind("--queue-policy=", 0) == 0)
+            logQueuePolicy = parseHopFull(arg.substr(15));
+        else if (arg.rfind("--socket=", 0) == 0)
+            subscriberSocketPath = arg.substr(9);
+        else if (arg.rfind("--durability=", 0) == 0)
+            logDurability = arg == "--durability=batch"    ? Durability::Batch
+                          : arg == "--durability=interval" ? Durability::Interval
+                                                           : Durability::None;
+        else
+            ledSources.push_back({LedSource::Attribute, arg});
+    }
+    if (allLeds) {
+        std::vector<LedSource> found = discoverLedSources();
+        ledSources.insert(ledSources.end(), found.begin(), found.end());
+    }
+    if (ledSources.empty())
+        ledSources.push_back({LedSource::Attribute, capsPath});
 
-    std::cout << "Monitoring Caps Lock at: " << capsPath << std::endl;
+    if (ledSources.size() > 1)
+        std::cout << "Monitoring " << ledSources.size() << " LED sources" << std::endl;
+    else
+        std::cout << "Monitoring Caps Lock at: " << ledSources.front().path << std::endl;
     std::cout << "Press Enter to stop..." << std::endl;
 
-    std::thread t1(monitorThread, capsPath);
-    std::thread t2(loggerThread);
+    LogWriterSink writer;
+    if (!writer.open())
+        return 1;
+    SubscriberSink subscribers;
+    if (!subscriberSocketPath.empty() && !subscribers.open(subscriberSocketPath))
+        return 1;
+    CapsLogger logger(MonitorSource{ledSources, mode}, LogHop(logQueuePolicy), WallClockStage(), FormatStage(),
+                      LogFanOut(std::move(writer), ConsoleSink(), std::move(subscribers)));
+
+    /* Thread 1 runs the monitor; the pipeline adds a thread behind the hop that
+     * formats, and the fan-out one per sink (log file, console, subscribers) */
+    std::thread t1([&logger]() { logger.run(); });
 
     std::cin.get();
 
-    running = false;
-    logCv.notify_all();
+    requestStop();
 
-    /* join because monitorThread might be still reading from file : it will read and exit*/
+    /* join because the monitor might be still reading from file : it will read and exit,
+     * and run() returns only after the logger thread has written everything queued */
     t1.join();
-    /* join because loggerThread might be still writing to file and the queue might not be empty */
-    t2.join();
+    logger.sink().close();
+    if (logger.part<0>().drops() > 0)
+        std::cout << "Lost " << logger.part<0>().drops() << " events (log queue full, policy "
+                  << hopFullName(logQueuePolicy) << ")" << std::endl;
+    printSinkStats(logger.sink().stats());
 
     std::cout << "Logger stopped." << std::endl;
     return 0;
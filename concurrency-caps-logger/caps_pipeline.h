@@ -0,0 +1,620 @@
+/* Header-only Source -> Stage... -> Sink pipeline.
+ *
+ *   Pipeline<Source, Parts...>   where Parts is Stages..., Sink
+ *
+ * Source: template <typename Emit> void run(Emit& emit)
+ *         calls emit(item) for every item, returns when it is done.
+ * Stage:  template <typename Item, typename Next> void operator()(const Item&, Next& next)
+ *         calls next(out) zero or more times (map, filter, split).
+ * Sink:   void operator()(const Item&)
+ * ThreadHop<T, Capacity>, placed between two parts, is a thread boundary:
+ * the parts after it run on a thread of their own, fed through an SpscRing
+ * of T. Without hops everything runs on the source's thread. What a full
+ * hop does is its HopFull policy; items it loses are counted exactly and,
+ * if T has a markLost() overload, reported downstream as a marker item. If
+ * T also has lostCount(), the number of items a marker reports (0 for
+ * other items), a marker the hop drops carries its count into its own.
+ *
+ * Parts between two hops are composed at compile time into nested calls
+ * the compiler inlines; only a hop costs a ring push and pop. Any part may
+ * also define flush(), called whenever the thread running it has drained
+ * what was queued (and after the source returns), and waitTimeoutMs(),
+ * bounding how long that thread sleeps when idle so flush() runs on time.
+ * FanOut<Item, Capacity, Sinks...> is a sink that hands every item to
+ * several sinks, each on its own thread behind its own ring. */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "caps_ring.h"
+
+/* What a ThreadHop does when its ring is full:
+ * Block:      the producer sleeps on an eventfd until the consumer has
+ *             freed half the ring; nothing is lost.
+ * DropNewest: the item being pushed is dropped.
+ * DropOldest: the oldest queued item is dropped to make room.
+ * Coalesce:   the item is set aside in one slot per coalesceKey(), merged
+ *             with coalesce() into what is already waiting there, and
+ *             delivered after the ring; each merge loses one item. A slot
+ *             moves to the back when merged into, so set-aside items come
+ *             out in the order of their latest update. Types without those
+ *             overloads fall back to DropNewest. */
+enum class HopFull { Block, DropNewest, DropOldest, Coalesce };
+
+template <typename T, typename = void>
+struct HasMarkLost : std::false_type {};
+template <typename T>
+struct HasMarkLost<T, std::void_t<decltype(markLost(std::declval<T&>(), 0ul))>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasLostCount : std::false_type {};
+template <typename T>
+struct HasLostCount<T, std::void_t<decltype(lostCount(std::declval<const T&>()))>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasCoalesce : std::false_type {};
+template <typename T>
+struct HasCoalesce<T, std::void_t<decltype(coalesceKey(std::declval<const T&>())),
+                                  decltype(coalesce(std::declval<T&>(), std::declval<const T&>()))>>
+    : std::true_type {};
+
+template <typename T, size_t Capacity = 1024>
+class ThreadHop {
+public:
+    using Item = T;
+    using LostMarker = void (*)(T& marker, unsigned long lost);
+
+    /* lostMarker turns a copy of the last item delivered (value-initialized
+     * if there was none) into the marker delivered after a loss, so it can
+     * keep that item's place in time; by default the markLost(T&, unsigned
+     * long) overload for T, if there is one */
+    explicit ThreadHop(HopFull full = HopFull::Block, LostMarker lostMarker = defaultLostMarker())
+        : state_(new State) {
+        state_->full = full;
+        if (full == HopFull::Coalesce && !HasCoalesce<T>::value)
+            state_->full = HopFull::DropNewest;
+        state_->lostMarker = lostMarker;
+    }
+
+    void push(const T& item) {
+        State& st = *state_;
+        /* Keep order: while items are set aside, later ones join them */
+        if (st.full == HopFull::Coalesce && st.coalescing.load(std::memory_order_acquire) && setAside(item, true))
+            return;
+        if (st.ring.tryPush(item))
+            return;
+        switch (st.full) {
+        case HopFull::Block:
+            while (!st.ring.tryPush(item))
+                waitForRoom();
+            break;
+        case HopFull::DropNewest:
+            lose(item);
+            break;
+        case HopFull::DropOldest: {
+            T oldest;
+            std::lock_guard<std::mutex> lock(st.popLock);
+            if (st.ring.tryPop(oldest))
+                lose(oldest);
+            st.ring.tryPush(item); /* Only this thread pushes: the freed slot is ours */
+            break;
+        }
+        case HopFull::Coalesce:
+            setAside(item, false);
+            break;
+        }
+    }
+
+    /* Queued items first, then whatever coalesced, then a lost-items marker
+     * if any were lost since the last one */
+    bool pop(T& item) {
+        State& st = *state_;
+        if (popItem(item)) {
+            if (st.lostMarker)
+                st.last = item;
+            return true;
+        }
+        if (st.lostMarker && st.unreported.load(std::memory_order_relaxed) > 0) {
+            item = st.last;
+            st.lostMarker(item, st.unreported.exchange(0, std::memory_order_relaxed));
+            return true;
+        }
+        return false;
+    }
+
+    bool empty() const { return state_->ring.empty() && !state_->coalescing.load(std::memory_order_acquire); }
+    void wait(int timeoutMs) { state_->ring.waitForData(timeoutMs, state_->closeFd); }
+
+    /* No more pushes will come: the consumer drains the ring and exits */
+    void close() {
+        state_->closing.store(true);
+        uint64_t one = 1;
+        if (write(state_->closeFd, &one, sizeof(one)) < 0) { /* already signalled */ }
+    }
+    bool closing() const { return state_->closing.load(); }
+
+    HopFull policy() const { return state_->full; }
+
+    /* Items lost to the policy so far (merged away, for Coalesce); a lost
+     * marker counts as one item here and as what it reported in ours */
+    unsigned long drops() const { return state_->drops.load(std::memory_order_relaxed); }
+
+    /* Most items ever set aside by Coalesce, i.e. distinct keys */
+    size_t maxAside() const { return state_->maxAside; }
+
+private:
+    static LostMarker defaultLostMarker() {
+        if constexpr (HasMarkLost<T>::value)
+            return [](T& marker, unsigned long lost) { markLost(marker, lost); };
+        else
+            return nullptr;
+    }
+
+    /* Block: park the producer until the consumer has freed half the ring.
+     * The producer announces itself and re-checks the ring before sleeping, the
+     * consumer checks for it after every pop; the seq_cst fences on both
+     * sides make sure one of them sees the other (as in ConsumerWakeup). */
+    void waitForRoom() {
+        State& st = *state_;
+        st.producerParked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (st.ring.full()) {
+            pollfd fd = {st.roomFd, POLLIN, 0};
+            poll(&fd, 1, -1);
+            uint64_t drained;
+            while (read(st.roomFd, &drained, sizeof(drained)) > 0) {}
+        }
+        st.producerParked.store(false, std::memory_order_relaxed);
+    }
+
+    bool popItem(T& item) {
+        State& st = *state_;
+        if (st.full == HopFull::DropOldest) {
+            std::lock_guard<std::mutex> lock(st.popLock);
+            if (st.ring.tryPop(item))
+                return true;
+        } else if (st.ring.tryPop(item)) {
+            if (st.full == HopFull::Block) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                /* Once half the ring is free, so the producer wakes to a batch
+                 * of room rather than for every slot; one signal per park */
+                if (st.producerParked.load(std::memory_order_relaxed) && st.ring.size() <= Capacity / 2
+                    && st.producerParked.exchange(false, std::memory_order_relaxed)) {
+                    uint64_t one = 1;
+                    if (write(st.roomFd, &one, sizeof(one)) < 0) { /* already signalled */ }
+                }
+            }
+            return true;
+        }
+        return st.full == HopFull::Coalesce && st.coalescing.load(std::memory_order_acquire) && takeAside(item);
+    }
+
+    void lose(const T& item) {
+        unsigned long reported = 1;
+        if constexpr (HasLostCount<T>::value)
+            reported = std::max(lostCount(item), 1ul);
+        state_->drops.fetch_add(1, std::memory_order_relaxed);
+        state_->unreported.fetch_add(reported, std::memory_order_relaxed);
+    }
+
+    /* With onlyWhileCoalescing, fails if the consumer has meanwhile taken
+     * the last item set aside, so the item goes through the ring (and wakes
+     * the consumer) instead */
+    bool setAside(const T& item, bool onlyWhileCoalescing) {
+        if constexpr (HasCoalesce<T>::value) {
+            State& st = *state_;
+            std::lock_guard<std::mutex> lock(st.asideLock);
+            if (onlyWhileCoalescing && !st.coalescing.load(std::memory_order_relaxed))
+                return false;
+            if constexpr (HasLostCount<T>::value) {
+                /* A marker has no key of its own to merge under: fold it into ours */
+                if (lostCount(item) > 0) {
+                    lose(item);
+                    return true;
+                }
+            }
+            auto key = coalesceKey(item);
+            bool merged = false;
+            for (auto it = st.aside.begin(); it != st.aside.end(); ++it) {
+                if (coalesceKey(*it) == key) {
+                    T waiting = *it;
+                    coalesce(waiting, item);
+                    st.aside.erase(it);
+                    st.aside.push_back(waiting); /* Now the newest */
+                    merged = true;
+                    break;
+                }
+            }
+            if (merged) {
+                lose(item);
+            } else {
+                st.aside.push_back(item);
+                st.maxAside = std::max(st.maxAside, st.aside.size());
+            }
+            st.coalescing.store(true, std::memory_order_release);
+        }
+        return true;
+    }
+
+    bool takeAside(T& item) {
+        State& st = *state_;
+        std::lock_guard<std::mutex> lock(st.asideLock);
+        if (st.aside.empty())
+            return false;
+        item = st.aside.front();
+        st.aside.erase(st.aside.begin());
+        if (st.aside.empty())
+            st.coalescing.store(false, std::memory_order_release);
+        return true;
+    }
+
+    struct State {
+        SpscRing<T, Capacity> ring;
+        HopFull full = HopFull::Block;
+        LostMarker lostMarker = nullptr;
+        int closeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        int roomFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK); /* Block: consumer freed a slot */
+        std::atomic<bool> producerParked{false};
+        std::atomic<bool> closing{false};
+        std::atomic<unsigned long> drops{0};
+        std::atomic<unsigned long> unreported{0};
+        std::mutex popLock;                 /* DropOldest: producer evicts, consumer pops */
+        std::mutex asideLock;               /* Coalesce */
+        std::atomic<bool> coalescing{false};
+        std::vector<T> aside;
+        size_t maxAside = 0;
+        T last{};                           /* Consumer only: last item delivered, for the marker */
+        ~State() {
+            ::close(closeFd);
+            ::close(roomFd);
+        }
+    };
+    std::unique_ptr<State> state_;
+};
+
+template <typename T>
+struct IsThreadHop : std::false_type {};
+template <typename T, size_t Capacity>
+struct IsThreadHop<ThreadHop<T, Capacity>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasFlush : std::false_type {};
+template <typename T>
+struct HasFlush<T, std::void_t<decltype(std::declval<T&>().flush())>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasWaitTimeout : std::false_type {};
+template <typename T>
+struct HasWaitTimeout<T, std::void_t<decltype(std::declval<T&>().waitTimeoutMs())>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasEnabled : std::false_type {};
+template <typename T>
+struct HasEnabled<T, std::void_t<decltype(std::declval<T&>().enabled())>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasDropped : std::false_type {};
+template <typename T>
+struct HasDropped<T, std::void_t<decltype(std::declval<const T&>().dropped())>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasQueuePolicy : std::false_type {};
+template <typename T>
+struct HasQueuePolicy<T, std::void_t<decltype(std::declval<const T&>().queuePolicy())>> : std::true_type {};
+
+template <typename T, typename = void>
+struct HasClose : std::false_type {};
+template <typename T>
+struct HasClose<T, std::void_t<decltype(std::declval<T&>().close())>> : std::true_type {};
+
+/* Consumer loop behind a hop: drain, flush, sleep until more arrives or
+ * the hop is closed; returns once the hop is closed and drained */
+template <typename Hop, typename Deliver, typename Flush, typename Timeout>
+void drainHop(Hop& hop, Deliver&& deliver, Flush&& flush, Timeout&& timeoutMs) {
+    typename Hop::Item item;
+    while (true) {
+        bool closing = hop.closing(); /* Read first: the drain below then sees every push before close */
+        while (hop.pop(item))
+            deliver(item);
+        flush();
+        if (closing)
+            break;
+        hop.wait(timeoutMs());
+    }
+}
+
+template <typename Source, typename... Parts>
+class Pipeline {
+    static_assert(sizeof...(Parts) >= 1, "a pipeline needs a sink");
+    using PartList = std::tuple<Parts...>;
+    static constexpr size_t LAST = sizeof...(Parts) - 1;
+    static_assert(!IsThreadHop<std::tuple_element_t<LAST, PartList>>::value, "the last part must be a sink");
+
+public:
+    explicit Pipeline(Source source, Parts... parts)
+        : source_(std::move(source)), parts_(std::move(parts)...) {}
+
+    /* Run the source on the calling thread until it returns, then close the
+     * hops front to back, each after the thread feeding it has finished, so
+     * every item emitted reaches the sink. */
+    void run() {
+        std::vector<std::thread> threads;
+        startHops<0>(threads);
+        auto emit = [this](const auto& item) { this->template deliver<0>(item); };
+        source_.run(emit);
+        flushSegment<0>();
+        closeHops<0>(threads, 0);
+    }
+
+    Source& source() { return source_; }
+
+    template <size_t I>
+    std::tuple_element_t<I, PartList>& part() { return std::get<I>(parts_); }
+
+    std::tuple_element_t<LAST, PartList>& sink() { return std::get<LAST>(parts_); }
+
+private:
+    template <size_t I, typename Item>
+    void deliver(const Item& item) {
+        using Part = std::tuple_element_t<I, PartList>;
+        Part& part = std::get<I>(parts_);
+        if constexpr (IsThreadHop<Part>::value) {
+            part.push(item);
+        } else if constexpr (I == LAST) {
+            part(item);
+        } else {
+            auto next = [this](const auto& out) { this->template deliver<I + 1>(out); };
+            part(item, next);
+        }
+    }
+
+    /* flush() every part from I up to the next hop */
+    template <size_t I>
+    void flushSegment() {
+        if constexpr (I <= LAST) {
+            using Part = std::tuple_element_t<I, PartList>;
+            if constexpr (!IsThreadHop<Part>::value) {
+                if constexpr (HasFlush<Part>::value)
+                    std::get<I>(parts_).flush();
+                flushSegment<I + 1>();
+            }
+        }
+    }
+
+    /* Shortest waitTimeoutMs() from I up to the next hop, -1 if none asks */
+    template <size_t I>
+    int segmentTimeoutMs() {
+        if constexpr (I <= LAST) {
+            using Part = std::tuple_element_t<I, PartList>;
+            if constexpr (!IsThreadHop<Part>::value) {
+                int rest = segmentTimeoutMs<I + 1>();
+                if constexpr (HasWaitTimeout<Part>::value) {
+                    int own = std::get<I>(parts_).waitTimeoutMs();
+                    if (own >= 0 && (rest < 0 || own < rest))
+                        return own;
+                }
+                return rest;
+            }
+        }
+        return -1;
+    }
+
+    /* Consumer side of the hop at I: runs parts I+1.. on its own thread */
+    template <size_t I>
+    void hopLoop() {
+        drainHop(std::get<I>(parts_),
+                 [this](const auto& item) { deliver<I + 1>(item); },
+                 [this] { flushSegment<I + 1>(); },
+                 [this] { return segmentTimeoutMs<I + 1>(); });
+    }
+
+    template <size_t I>
+    void startHops(std::vector<std::thread>& threads) {
+        if constexpr (I <= LAST) {
+            if constexpr (IsThreadHop<std::tuple_element_t<I, PartList>>::value)
+                threads.emplace_back([this] { hopLoop<I>(); });
+            startHops<I + 1>(threads);
+        }
+    }
+
+    template <size_t I>
+    void closeHops(std::vector<std::thread>& threads, size_t index) {
+        if constexpr (I <= LAST) {
+            if constexpr (IsThreadHop<std::tuple_element_t<I, PartList>>::value) {
+                std::get<I>(parts_).close();
+                threads[index].join();
+                closeHops<I + 1>(threads, index + 1);
+            } else {
+                closeHops<I + 1>(threads, index);
+            }
+        }
+    }
+
+    Source source_;
+    PartList parts_;
+};
+
+/* Per-sink counters of a FanOut. Lag is the time from an item entering the
+ * sink's ring to the sink having taken it. */
+struct SinkStats {
+    const char* name;
+    bool enabled;
+    unsigned long delivered; /* Not counting lost markers */
+    unsigned long dropped;   /* Ring was full: lost for this sink only */
+    unsigned long pending;   /* Queued, not yet delivered; with the two above adds up to what was pushed */
+    unsigned long sinkDropped; /* Delivered, then discarded by the sink itself, in its own units (dropped()) */
+    int64_t lastLagNs;
+    int64_t maxLagNs;
+};
+
+/* Sink that hands every item to each of Sinks..., each on its own thread
+ * behind its own bounded ring. A sink that is slow or blocked fills its own
+ * ring, and what happens then is that sink's queuePolicy() (a HopFull; if
+ * it has none, DropNewest, followed by a lost marker, see ThreadHop): the
+ * others never wait for it unless it chose Block, which holds up the
+ * FanOut's caller and so every sink. Sinks
+ * provide name(), may provide enabled() (disabled ones get no thread and no
+ * items), flush()/waitTimeoutMs() as for pipeline parts, close(), called
+ * on their thread's behalf once it has drained, and dropped(), items the
+ * sink took but had to discard itself (read from other threads). */
+template <typename Item, size_t Capacity, typename... Sinks>
+class FanOut {
+public:
+    explicit FanOut(Sinks... sinks) : lanes_(std::make_unique<Lane<Sinks>>(std::move(sinks))...) {
+        std::apply([](auto&... lane) { (lane->start(), ...); }, lanes_);
+    }
+    FanOut(FanOut&&) = default;
+    ~FanOut() { close(); }
+
+    void operator()(const Item& item) {
+        int64_t now = steadyNs();
+        std::apply([&](auto&... lane) { (lane->push(item, now), ...); }, lanes_);
+    }
+
+    /* Drain every sink's ring, stop the threads and close the sinks */
+    void close() {
+        std::apply([](auto&... lane) { ((lane ? lane->stop() : void()), ...); }, lanes_);
+    }
+
+    template <size_t I>
+    auto& sink() { return std::get<I>(lanes_)->sink; }
+
+    std::vector<SinkStats> stats() const {
+        std::vector<SinkStats> all;
+        std::apply([&](const auto&... lane) { (all.push_back(lane->stats()), ...); }, lanes_);
+        return all;
+    }
+
+private:
+    static int64_t steadyNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Entry {
+        Item item;
+        int64_t enqueuedNs;
+        bool marker;
+
+        /* A lane's hop sees the Item's lostCount() and, for HopFull::Coalesce,
+         * merges the Items, if they provide those */
+        template <typename I = Item>
+        friend auto lostCount(const Entry& entry) -> decltype(lostCount(std::declval<const I&>())) {
+            return lostCount(entry.item);
+        }
+        template <typename I = Item>
+        friend auto coalesceKey(const Entry& entry) -> decltype(coalesceKey(std::declval<const I&>())) {
+            return coalesceKey(entry.item);
+        }
+        template <typename I = Item>
+        friend auto coalesce(Entry& pending, const Entry& newer)
+            -> decltype(coalesce(std::declval<I&>(), std::declval<const I&>())) {
+            coalesce(pending.item, newer.item);
+        }
+    };
+
+    /* A sink that dropped gets the Item's lost marker in the gap */
+    static typename ThreadHop<Entry, Capacity>::LostMarker entryMarker() {
+        if constexpr (HasMarkLost<Item>::value)
+            return [](Entry& marker, unsigned long lost) {
+                markLost(marker.item, lost);
+                marker.enqueuedNs = steadyNs();
+                marker.marker = true;
+            };
+        else
+            return nullptr;
+    }
+
+    template <typename Sink>
+    struct Lane {
+        explicit Lane(Sink s) : sink(std::move(s)), hop(policy(sink), entryMarker()) {
+            if constexpr (HasEnabled<Sink>::value)
+                enabled = sink.enabled();
+        }
+
+        static HopFull policy(const Sink& sink) {
+            if constexpr (HasQueuePolicy<Sink>::value)
+                return sink.queuePolicy();
+            return HopFull::DropNewest;
+        }
+
+        void start() {
+            if (enabled)
+                thread = std::thread([this] { run(); });
+        }
+
+        void push(const Item& item, int64_t now) {
+            if (!enabled)
+                return;
+            pushed.fetch_add(1, std::memory_order_relaxed);
+            hop.push(Entry{item, now, false});
+        }
+
+        void run() {
+            drainHop(hop,
+                     [this](const Entry& entry) {
+                         sink(entry.item);
+                         if (entry.marker)
+                             return;
+                         int64_t lag = steadyNs() - entry.enqueuedNs;
+                         lastLagNs.store(lag, std::memory_order_relaxed);
+                         if (lag > maxLagNs.load(std::memory_order_relaxed))
+                             maxLagNs.store(lag, std::memory_order_relaxed);
+                         delivered.fetch_add(1, std::memory_order_relaxed);
+                     },
+                     [this] {
+                         if constexpr (HasFlush<Sink>::value)
+                             sink.flush();
+                     },
+                     [this] {
+                         if constexpr (HasWaitTimeout<Sink>::value)
+                             return sink.waitTimeoutMs();
+                         return -1;
+                     });
+        }
+
+        void stop() {
+            if (thread.joinable()) {
+                hop.close();
+                thread.join();
+            }
+            if (enabled && !closed) {
+                if constexpr (HasClose<Sink>::value)
+                    sink.close();
+            }
+            closed = true;
+        }
+
+        SinkStats stats() const {
+            unsigned long drops = hop.drops();
+            unsigned long done = delivered.load(std::memory_order_relaxed);
+            unsigned long in = pushed.load(std::memory_order_relaxed);
+            unsigned long sinkDrops = 0;
+            if constexpr (HasDropped<Sink>::value)
+                sinkDrops = sink.dropped();
+            return SinkStats{sink.name(), enabled, done, drops, in - drops - done, sinkDrops,
+                             lastLagNs.load(std::memory_order_relaxed), maxLagNs.load(std::memory_order_relaxed)};
+        }
+
+        Sink sink;
+        bool enabled = true;
+        bool closed = false;
+        ThreadHop<Entry, Capacity> hop;
+        std::thread thread;
+        std::atomic<unsigned long> pushed{0};
+        std::atomic<unsigned long> delivered{0};
+        std::atomic<int64_t> lastLagNs{0};
+        std::atomic<int64_t> maxLagNs{0};
+    };
+
+    std::tuple<std::unique_ptr<Lane<Sinks>>...> lanes_;
+};
@@ -0,0 +1,177 @@
+/* Bounded lock-free rings used to hand events between the caps logger's
+ * threads: SpscRing for one producer, MpscRing for several, both with a
+ * single consumer that sleeps on an eventfd while the ring is empty. */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/* Parks the single consumer of a ring on an eventfd.
+ * The consumer announces itself in waiting_ and re-checks the ring before
+ * sleeping; a producer rings the eventfd only when it filled the slot the
+ * consumer is parked on, i.e. when the ring went from empty to non-empty,
+ * and only if the consumer is actually asleep. The seq_cst fences on both
+ * sides make sure one of them sees the other. */
+class ConsumerWakeup {
+public:
+    ConsumerWakeup() : eventFd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {}
+    ~ConsumerWakeup() { close(eventFd_); }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_relaxed)) {
+            uint64_t one = 1;
+            if (write(eventFd_, &one, sizeof(one)) < 0) { /* already signalled */ }
+            signals_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /* Sleep until the ring has data, alsoWakeFd (e.g. a stop eventfd) becomes
+     * readable or timeoutMs passes (-1: forever) */
+    template <typename Ring>
+    bool wait(const Ring& ring, int timeoutMs, int alsoWakeFd) {
+        waiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.empty()) {
+            pollfd fds[2] = {{eventFd_, POLLIN, 0}, {alsoWakeFd, POLLIN, 0}};
+            poll(fds, alsoWakeFd == -1 ? 1 : 2, timeoutMs);
+            uint64_t drained;
+            while (read(eventFd_, &drained, sizeof(drained)) > 0) {}
+        }
+        waiting_.store(false, std::memory_order_relaxed);
+        return !ring.empty();
+    }
+
+    unsigned long signals() const { return signals_.load(std::memory_order_relaxed); }
+
+private:
+    int eventFd_;
+    alignas(64) std::atomic<bool> waiting_{false};
+    std::atomic<unsigned long> signals_{0};
+};
+
+/* Bounded single-producer/single-consumer ring (e.g. one monitor, one logger).
+ * Head and tail live on their own cache lines; a push is one slot copy and
+ * one release store, no lock and no allocation. tryPush fails when full. */
+template <typename T, size_t Capacity = 4096>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool tryPush(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots_[tail & (Capacity - 1)] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (head_.load(std::memory_order_relaxed) == tail)
+            wake_.notify();
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        item = slots_[head & (Capacity - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+    /* Consumer side: items queued (at least) */
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed);
+    }
+
+    /* Producer side: no room for another push */
+    bool full() const {
+        return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) == Capacity;
+    }
+
+    bool waitForData(int timeoutMs, int alsoWakeFd = -1) { return wake_.wait(*this, timeoutMs, alsoWakeFd); }
+    unsigned long wakeups() const { return wake_.signals(); }
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    ConsumerWakeup wake_;
+    alignas(64) T slots_[Capacity];
+};
+
+/* Bounded multi-producer/single-consumer ring (e.g. several monitors, one logger).
+ * Producers claim a slot with a CAS on tail and publish it through the
+ * slot's sequence number, so a slow producer never blocks the others from
+ * claiming; the consumer simply stops at the first unpublished slot. */
+template <typename T, size_t Capacity = 4096>
+class MpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    MpscRing() {
+        for (size_t i = 0; i < Capacity; i++)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(const T& item) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & (Capacity - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; /* Full: the consumer has not freed this slot yet */
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = item;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (head_.load(std::memory_order_relaxed) == pos)
+            wake_.notify();
+        return true;
+    }
+
+    bool tryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[head & (Capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != head + 1)
+            return false;
+        item = slot.value;
+        slot.seq.store(head + Capacity, std::memory_order_release);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        size_t head = head_.load(std::memory_order_relaxed);
+        return slots_[head & (Capacity - 1)].seq.load(std::memory_order_acquire) != head + 1;
+    }
+
+    bool waitForData(int timeoutMs, int alsoWakeFd = -1) { return wake_.wait(*this, timeoutMs, alsoWakeFd); }
+    unsigned long wakeups() const { return wake_.signals(); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    ConsumerWakeup wake_;
+    alignas(64) Slot slots_[Capacity];
+};